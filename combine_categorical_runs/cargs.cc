@@ -9,7 +9,42 @@
 
 void combine_categorical_runs::cargs::initialize_options() {
   _desc.add_options()("help,h", "emit this help message")(
-      "output-prefix,o",
-      boost::program_options::value<std::string>()->default_value("out"),
-      "prefix of all output files written by software");
+      "max-memory",
+      boost::program_options::value<unsigned>()->default_value(0),
+      "memory budget in MB for consensus variant detection; nonzero values "
+      "spill sorted variant runs to scratch space, and peak memory is then "
+      "about this budget plus 5MB")(
+      "scratch-directory",
+      boost::program_options::value<std::string>()->default_value(""),
+      "directory for temporary spill files (default: system temp directory)")(
+      "threads", boost::program_options::value<unsigned>()->default_value(1),
+      "number of threads for consensus variant detection across input "
+      "files; peak memory of this step does not depend on the thread "
+      "count, and is about 32 bytes per input line across all input files")(
+      "decompression-threads",
+      boost::program_options::value<unsigned>()->default_value(1),
+      "number of threads for decompressing each gzip input file; BGZF "
+      "(bgzip) input is split at its blocks, and ordinary gzip input at "
+      "block boundaries found by search, using about 25 MB per thread")(
+      "incremental-input",
+      boost::program_options::value<std::string>()->default_value(""),
+      "existing combined output to extend with a single new comparison")(
+      "report-datasets",
+      "append a DATASETS column listing datasets counted toward N; required "
+      "for later incremental runs")(
+      "max-consensus-p",
+      boost::program_options::value<double>()->default_value(1.0),
+      "only report variants with consensus p-value at most this value")(
+      "max-min-p", boost::program_options::value<double>()->default_value(1.0),
+      "only report variants with minimum comparison p-value at most this "
+      "value")(
+      "top-k", boost::program_options::value<unsigned>()->default_value(0),
+      "only report this many variants with smallest consensus p-value "
+      "(default: all)")(
+      "filter-report",
+      boost::program_options::value<std::string>()->default_value(""),
+      "optional file reporting per-chromosome counts of filtered variants")(
+      "input-files",
+      boost::program_options::value<std::vector<std::string> >(),
+      "SAIGE output files, model matrix files, and output filename");
 }
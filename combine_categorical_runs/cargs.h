@@ -32,8 +32,14 @@ class cargs {
    */
   cargs(int argc, char **argv) : _desc("Recognized options") {
     initialize_options();
+    boost::program_options::positional_options_description positional;
+    positional.add("input-files", -1);
     boost::program_options::store(
-        boost::program_options::parse_command_line(argc, argv, _desc), _vm);
+        boost::program_options::command_line_parser(argc, argv)
+            .options(_desc)
+            .positional(positional)
+            .run(),
+        _vm);
     boost::program_options::notify(_vm);
   }
   /*!
@@ -100,13 +106,6 @@ class cargs {
   std::string get_reference_vcf() const {
     return compute_parameter<std::string>("reference-vcf");
   }
-  /*!
-    \brief access requested prefix of output file(s)
-    \return prefix of output file(s)
-   */
-  std::string get_output_prefix() const {
-    return compute_parameter<std::string>("output-prefix");
-  }
   /*!
     \brief find out whether user wants output run through gzip
     \return whether user wants output run through gzip
@@ -234,6 +233,103 @@ class cargs {
   std::string get_merge_set2_inclusion_variant_filename() const {
     return compute_parameter<std::string>("merge-set2-inclusion-variants");
   }
+  /*!
+    \brief get all positional file arguments: SAIGE output files, model
+    matrix files, and finally the output filename
+    \return positional arguments in the order provided
+   */
+  std::vector<std::string> get_input_files() const {
+    if (!_vm.count("input-files")) return std::vector<std::string>();
+    return compute_parameter<std::vector<std::string> >("input-files");
+  }
+
+  /*!
+    \brief get memory budget for the consensus variant pre-pass, in megabytes
+    \return requested budget, or 0 for the unbounded in-memory pre-pass
+
+    When nonzero, variant IDs are counted by spilling sorted runs to scratch
+    space and merging them, rather than holding every ID in a single map.
+    The budget covers all sort buffers; the rest of the program adds a few
+    megabytes.
+   */
+  unsigned get_max_memory() const {
+    return compute_parameter<unsigned>("max-memory");
+  }
+
+  /*!
+    \brief get directory in which to place temporary spill files
+    \return requested directory, or "" for the system temporary directory
+   */
+  std::string get_scratch_directory() const {
+    return compute_parameter<std::string>("scratch-directory");
+  }
+
+  /*!
+    \brief get number of threads for the consensus variant pre-pass
+    \return requested number of threads
+
+    Ignored when --max-memory is set.
+   */
+  unsigned get_threads() const {
+    return compute_parameter<unsigned>("threads");
+  }
+
+  /*!
+    \brief get number of threads for decompressing each gzip input
+    \return requested number of decompression threads
+   */
+  unsigned get_decompression_threads() const {
+    return compute_parameter<unsigned>("decompression-threads");
+  }
+
+  /*!
+    \brief get existing combined output to extend with a new comparison
+    \return name of existing combined output, or "" for a full run
+
+    The existing output must have been written with --report-datasets.
+   */
+  std::string get_incremental_input() const {
+    return compute_parameter<std::string>("incremental-input");
+  }
+
+  /*!
+    \brief determine whether the datasets counted toward N should be reported
+    \return whether to append a DATASETS column to output
+
+    This column is required for later incremental runs.
+   */
+  bool report_datasets() const { return compute_flag("report-datasets"); }
+
+  /*!
+    \brief get largest consensus p-value to report
+    \return largest consensus p-value to report
+   */
+  double get_max_consensus_p() const {
+    return compute_parameter<double>("max-consensus-p");
+  }
+
+  /*!
+    \brief get largest per-comparison minimum p-value to report
+    \return largest per-comparison minimum p-value to report
+   */
+  double get_max_min_p() const {
+    return compute_parameter<double>("max-min-p");
+  }
+
+  /*!
+    \brief get number of most significant rows to report
+    \return number of rows to report, or 0 to report all passing rows
+   */
+  unsigned get_top_k() const { return compute_parameter<unsigned>("top-k"); }
+
+  /*!
+    \brief get name of optional per-chromosome filtering report
+    \return name of report file, or "" if not requested
+   */
+  std::string get_filter_report() const {
+    return compute_parameter<std::string>("filter-report");
+  }
+
   /*!
     \brief find status of arbitrary flag
     @param tag name of flag
@@ -0,0 +1,427 @@
+/*!
+  \file combiner.cc
+  \brief method implementation for streaming combiner
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+// required definition for mpfr in C++
+#define MPFR_USE_INTMAX_T 1
+
+#include "combine_categorical_runs/combiner.h"
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdarg>
+#include <limits>
+#include <sstream>
+
+// this inclusion must come after inttypes and stdarg
+#include <mpfr.h>  // NOLINT
+
+void combine_categorical_runs::parse_variant_id(const std::string &line,
+                                                const std::string &source_name,
+                                                std::string *variant_id) {
+  if (!variant_id) throw std::domain_error("parse_variant_id: null pointer");
+  std::istringstream strm1(line);
+  std::string catcher = "", a1 = "", a2 = "";
+  if (!(strm1 >> catcher >> catcher >> *variant_id >> a1 >> a2))
+    throw std::domain_error("insufficient entries for file \"" + source_name +
+                            "\" line \"" + line + "\"");
+  *variant_id = *variant_id + ":" + (a1 < a2 ? a1 : a2) + ":" +
+                (a1 < a2 ? a2 : a1);
+}
+
+void combine_categorical_runs::parse_comparison_record(
+    const std::string &line, const std::string &source_name,
+    comparison_record *record) {
+  if (!record)
+    throw std::domain_error("parse_comparison_record: null pointer");
+  std::istringstream strm1(line);
+  std::string catcher = "";
+  record->annotation.resize(6);
+  for (unsigned i = 0; i < 6; ++i) {
+    if (!(strm1 >> record->annotation.at(i)))
+      throw std::domain_error("insufficient entries for file \"" +
+                              source_name + "\" line \"" + line + "\"");
+  }
+  const std::string &a1 = record->annotation.at(3),
+                    &a2 = record->annotation.at(4);
+  record->variant_id = record->annotation.at(2) + ":" + (a1 < a2 ? a1 : a2) +
+                       ":" + (a1 < a2 ? a2 : a1);
+  if (!(strm1 >> record->beta >> catcher >> record->pvalue >> catcher >>
+        catcher >> record->n.first >> record->n.second))
+    throw std::domain_error("insufficient entries for file \"" + source_name +
+                            "\" line \"" + line + "\"");
+}
+
+void combine_categorical_runs::count_variant_ids(
+    const std::vector<comparison_record> &records,
+    std::map<std::string, unsigned> *target) {
+  if (!target) throw std::domain_error("count_variant_ids: null pointer");
+  for (std::vector<comparison_record>::const_iterator iter = records.begin();
+       iter != records.end(); ++iter) {
+    ++(*target)[iter->variant_id];
+  }
+}
+
+double combine_categorical_runs::compute_consensus_p(double min_p,
+                                                     unsigned n_valid) {
+  // output p-value is, evidently, 1 - prod(1 - min(p))
+  // just a simple Bonferroni correction
+
+  // precision error! if p is low enough,
+  // this math fails with double precision
+  if (min_p < 5e-8) {
+    // treat individual variants with GWS values carefully.
+    // this is way too large by the way! double precision works
+    // ok for these. but it eventually breaks down, and GWS
+    // as a threshold for different treatment is a thing that
+    // is accepted in GWAS
+
+    // use mpfr!
+    double consensus_p = 0.0;
+    mpfr_t x, y;
+    try {
+      mpfr_inits2(256, x, y, (mpfr_ptr)0);
+      mpfr_set_d(x, min_p, MPFR_RNDD);
+      mpfr_ui_sub(y, 1, x, MPFR_RNDD);
+      mpfr_pow_ui(x, y, n_valid, MPFR_RNDD);
+      mpfr_ui_sub(y, 1, x, MPFR_RNDD);
+      consensus_p = mpfr_get_d(y, MPFR_RNDD);
+      mpfr_clears(x, y, (mpfr_ptr)0);
+    } catch (...) {
+      mpfr_clears(x, y, (mpfr_ptr)0);
+      throw;
+    }
+    return consensus_p;
+  }
+  return 1 - pow(1.0 - min_p, n_valid);
+}
+
+void combine_categorical_runs::add_unique_sample_size(
+    unsigned comparison_number, const std::pair<unsigned, unsigned> &input_n,
+    const combinatorial_counts &counts,
+    std::map<std::string, bool> *tracked_datasets,
+    unsigned *unique_sample_size) {
+  if (!tracked_datasets || !unique_sample_size)
+    throw std::domain_error("add_unique_sample_size: null pointer");
+  // find the sample size for this comparison number
+  std::map<std::pair<unsigned, unsigned>,
+           std::map<std::string, std::pair<unsigned, unsigned> > >::
+      const_iterator comparison_finder =
+          counts.at(comparison_number).find(input_n);
+  if (comparison_finder == counts.at(comparison_number).end()) {
+    std::ostringstream o_exception;
+    o_exception << "combinatorial sample size lookup failed: comparison "
+                << comparison_number << "; expected " << input_n.first << "/"
+                << input_n.second << std::endl;
+    o_exception << "available:";
+    for (std::map<std::pair<unsigned, unsigned>,
+                  std::map<std::string, std::pair<unsigned, unsigned> > >::
+             const_iterator except_iter = counts.at(comparison_number).begin();
+         except_iter != counts.at(comparison_number).end(); ++except_iter) {
+      o_exception << ' ' << except_iter->first.first << '/'
+                  << except_iter->first.second;
+    }
+    throw std::runtime_error(o_exception.str());
+  }
+  // look at each constituent dataset. if it's not already present, add
+  // the whole number; otherwise only add the nonreference subjects
+  for (std::map<std::string, std::pair<unsigned, unsigned> >::const_iterator
+           subset_iter = comparison_finder->second.begin();
+       subset_iter != comparison_finder->second.end(); ++subset_iter) {
+    if (tracked_datasets->find(subset_iter->first) !=
+        tracked_datasets->end()) {
+      *unique_sample_size += subset_iter->second.second;
+    } else {
+      (*tracked_datasets)[subset_iter->first] = true;
+      *unique_sample_size += subset_iter->second.first;
+    }
+  }
+}
+
+std::string combine_categorical_runs::format_tracked_datasets(
+    const std::map<std::string, bool> &tracked_datasets) {
+  std::ostringstream o;
+  for (std::map<std::string, bool>::const_iterator iter =
+           tracked_datasets.begin();
+       iter != tracked_datasets.end(); ++iter) {
+    o << (iter == tracked_datasets.begin() ? "" : ",") << iter->first;
+  }
+  return o.str();
+}
+
+std::string combine_categorical_runs::format_combined_header(
+    const std::vector<unsigned> &comparison_numbers, bool report_datasets,
+    bool filtered) {
+  std::ostringstream o_header;
+  o_header << "CHR\tPOS\tSNP\tTested_Allele\tOther_Allele\tFreq_Tested_"
+              "Allele_in_TOPMed";
+  for (unsigned i = 0; i < comparison_numbers.size(); ++i) {
+    o_header << "\tBETA_COMP" << comparison_numbers.at(i);
+  }
+  for (unsigned i = 0; i < comparison_numbers.size(); ++i) {
+    o_header << "\tP_COMP" << comparison_numbers.at(i);
+  }
+  o_header << "\tP_CONSENSUS\tN";
+  if (report_datasets)
+    o_header << (filtered ? "\tFILTERED_DATASETS" : "\tDATASETS");
+  return o_header.str();
+}
+
+std::string combine_categorical_runs::format_combined_record(
+    const combined_record &record, bool report_datasets) {
+  std::ostringstream o;
+  // output with datasets may be read back by process_incremental, which
+  // recomputes the consensus p-value from these columns
+  if (report_datasets) o.precision(std::numeric_limits<double>::max_digits10);
+  for (unsigned i = 0; i < record.annotation.size(); ++i) {
+    o << (i ? "\t" : "") << record.annotation.at(i);
+  }
+  for (unsigned i = 0; i < record.betas.size(); ++i) {
+    o << '\t' << record.betas.at(i);
+  }
+  for (unsigned i = 0; i < record.pvalues.size(); ++i) {
+    o << '\t' << record.pvalues.at(i);
+  }
+  o << '\t' << record.consensus_p;
+  o << '\t' << record.n;
+  if (report_datasets) {
+    o << '\t';
+    for (unsigned i = 0; i < record.datasets.size(); ++i) {
+      o << (i ? "," : "") << record.datasets.at(i);
+    }
+  }
+  return o.str();
+}
+
+combine_categorical_runs::combiner::combiner(
+    const std::vector<unsigned> &comparison_numbers,
+    const combinatorial_counts &counts, const record_callback &callback,
+    consensus_filter *consensus)
+    : _comparison_numbers(comparison_numbers),
+      _counts(counts),
+      _callback(callback),
+      _consensus(consensus) {
+  if (comparison_numbers.size() < 2)
+    throw std::domain_error("combiner: expected at least two inputs");
+  if (!_callback) throw std::domain_error("combiner: empty callback");
+  if (!_consensus) throw std::domain_error("combiner: null consensus filter");
+  _inputs.resize(comparison_numbers.size());
+}
+
+void combine_categorical_runs::combiner::set_source_names(
+    const std::vector<std::string> &names) {
+  if (names.size() != _inputs.size())
+    throw std::domain_error(
+        "combiner::set_source_names: expected one name per input");
+  _source_names = names;
+}
+
+void combine_categorical_runs::combiner::push(unsigned input_index,
+                                              const comparison_record &record) {
+  if (admit(input_index, record.variant_id))
+    _inputs.at(input_index).queued.push_back(record);
+  resolve_available();
+}
+
+void combine_categorical_runs::combiner::push_buffer(
+    unsigned input_index, const std::string &buffer) {
+  input_state &input = _inputs.at(input_index);
+  std::string::size_type start = 0, end = 0;
+  while ((end = buffer.find('\n', start)) != std::string::npos) {
+    if (input.partial_line.empty()) {
+      push_line(input_index, buffer.substr(start, end - start));
+    } else {
+      input.partial_line += buffer.substr(start, end - start);
+      std::string line = "";
+      line.swap(input.partial_line);
+      push_line(input_index, line);
+    }
+    start = end + 1;
+  }
+  input.partial_line += buffer.substr(start);
+}
+
+void combine_categorical_runs::combiner::finish(unsigned input_index) {
+  input_state &input = _inputs.at(input_index);
+  if (input.finished) return;
+  if (!input.partial_line.empty()) {
+    std::string line = "";
+    line.swap(input.partial_line);
+    push_line(input_index, line);
+  }
+  input.finished = true;
+  resolve_available();
+}
+
+void combine_categorical_runs::combiner::pull(
+    const std::vector<record_source> &sources) {
+  if (sources.size() != _inputs.size())
+    throw std::domain_error("combiner::pull: expected one source per input");
+  comparison_record record;
+  pull_until_complete([&](unsigned i) {
+    if (!sources.at(i)(&record)) return false;
+    push(i, record);
+    return true;
+  });
+}
+
+void combine_categorical_runs::combiner::pull_lines(
+    const std::vector<line_source> &sources) {
+  if (sources.size() != _inputs.size())
+    throw std::domain_error(
+        "combiner::pull_lines: expected one source per input");
+  std::string line = "";
+  pull_until_complete([&](unsigned i) {
+    if (!sources.at(i)(&line)) return false;
+    push_data_line(i, line);
+    return true;
+  });
+}
+
+void combine_categorical_runs::combiner::pull_until_complete(
+    const std::function<bool(unsigned)> &advance) {
+  while (!complete()) {
+    bool progressed = false;
+    for (unsigned i = 0; i < _inputs.size(); ++i) {
+      while (!_inputs.at(i).finished && !_inputs.at(i).has_current &&
+             _inputs.at(i).queued.empty()) {
+        if (!advance(i)) finish(i);
+        progressed = true;
+      }
+    }
+    if (!progressed)
+      throw std::logic_error("combiner::pull: no input can make progress");
+  }
+}
+
+bool combine_categorical_runs::combiner::complete() const {
+  for (std::vector<input_state>::const_iterator iter = _inputs.begin();
+       iter != _inputs.end(); ++iter) {
+    if (!iter->finished || iter->has_current || !iter->queued.empty())
+      return false;
+  }
+  return true;
+}
+
+void combine_categorical_runs::combiner::push_line(unsigned input_index,
+                                                   const std::string &line) {
+  input_state &input = _inputs.at(input_index);
+  if (!input.header_seen) {
+    input.header_seen = true;
+    return;
+  }
+  push_data_line(input_index, line);
+}
+
+void combine_categorical_runs::combiner::push_data_line(
+    unsigned input_index, const std::string &line) {
+  // only the ID columns are needed to reject a row, and rejected rows are
+  // not required to carry valid statistics
+  std::string variant_id = "";
+  parse_variant_id(line, source_name(input_index), &variant_id);
+  if (admit(input_index, variant_id)) {
+    comparison_record record;
+    parse_comparison_record(line, source_name(input_index), &record);
+    _inputs.at(input_index).queued.push_back(record);
+  }
+  resolve_available();
+}
+
+bool combine_categorical_runs::combiner::admit(unsigned input_index,
+                                               const std::string &variant_id) {
+  input_state &input = _inputs.at(input_index);
+  if (input.finished)
+    throw std::logic_error("combiner::push: " + source_name(input_index) +
+                           " already finished");
+  if (_consensus->retain(input_index, variant_id)) return true;
+  // queue a placeholder, so the rejection clears this input's last variant
+  // at the same point in the stream as it would in a single file pass
+  input.queued.push_back(comparison_record());
+  return false;
+}
+
+bool combine_categorical_runs::combiner::ready() const {
+  bool any_current = false;
+  for (std::vector<input_state>::const_iterator iter = _inputs.begin();
+       iter != _inputs.end(); ++iter) {
+    if (!iter->has_current && !iter->finished) return false;
+    if (iter->has_current) any_current = true;
+  }
+  return any_current;
+}
+
+void combine_categorical_runs::combiner::resolve_available() {
+  while (true) {
+    for (std::vector<input_state>::iterator iter = _inputs.begin();
+         iter != _inputs.end(); ++iter) {
+      while (!iter->has_current && !iter->queued.empty()) {
+        if (iter->queued.front().variant_id.empty()) {
+          iter->current.variant_id = "";
+        } else {
+          iter->current = iter->queued.front();
+          iter->has_current = true;
+        }
+        iter->queued.pop_front();
+      }
+    }
+    if (!ready()) return;
+    resolve_step();
+  }
+}
+
+void combine_categorical_runs::combiner::resolve_step() {
+  // the target is the variant of the last input with data available
+  std::string target_id = "";
+  for (std::vector<input_state>::const_iterator iter = _inputs.begin();
+       iter != _inputs.end(); ++iter) {
+    if (iter->has_current) target_id = iter->current.variant_id;
+  }
+  combined_record res;
+  unsigned n_valid = 0;
+  for (std::vector<input_state>::iterator iter = _inputs.begin();
+       iter != _inputs.end(); ++iter) {
+    if (!iter->current.variant_id.compare(target_id)) {
+      if (iter->current.pvalue < res.min_p) res.min_p = iter->current.pvalue;
+      ++n_valid;
+      if (res.annotation.empty() && iter->has_current)
+        res.annotation = iter->current.annotation;
+      iter->has_current = false;
+    }
+  }
+  // for the time being, for strange meta-analysis consistency reasons,
+  // enforce presence in all input files
+  if (n_valid != _inputs.size()) return;
+  res.consensus_p = compute_consensus_p(res.min_p, n_valid);
+  res.betas.reserve(_inputs.size());
+  res.pvalues.reserve(_inputs.size());
+  for (std::vector<input_state>::const_iterator iter = _inputs.begin();
+       iter != _inputs.end(); ++iter) {
+    res.betas.push_back(iter->current.beta);
+    res.pvalues.push_back(iter->current.pvalue);
+  }
+  if (_predicate && !_predicate(res)) return;
+  // need to track which datasets have already had data included for any
+  // prior comparison
+  std::map<std::string, bool> tracked_datasets;
+  for (unsigned i = 0; i < _inputs.size(); ++i) {
+    add_unique_sample_size(_comparison_numbers.at(i), _inputs.at(i).current.n,
+                           _counts, &tracked_datasets, &res.n);
+  }
+  for (std::map<std::string, bool>::const_iterator iter =
+           tracked_datasets.begin();
+       iter != tracked_datasets.end(); ++iter) {
+    res.datasets.push_back(iter->first);
+  }
+  _callback(res);
+}
+
+std::string combine_categorical_runs::combiner::source_name(
+    unsigned input_index) const {
+  if (!_source_names.empty()) return _source_names.at(input_index);
+  std::ostringstream o;
+  o << "input " << input_index;
+  return o.str();
+}
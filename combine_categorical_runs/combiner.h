@@ -0,0 +1,307 @@
+/*!
+ \file combiner.h
+ \brief streaming combination of per-comparison SAIGE results into consensus
+ results
+ \copyright Released under the MIT License.
+ Copyright 2021 Cameron Palmer
+
+ This is the in-memory core of the software. File handling lives in
+ process.h; this interface accepts parsed records or raw text and reports
+ combined records through callbacks, so it can be embedded without
+ temporary files.
+ */
+
+#ifndef COMBINE_CATEGORICAL_RUNS_COMBINER_H_
+#define COMBINE_CATEGORICAL_RUNS_COMBINER_H_
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "combine_categorical_runs/consensus.h"
+
+namespace combine_categorical_runs {
+/*!
+  \brief for each comparison number, map from (cases, controls) observed in a
+  SAIGE row to the datasets and their (total, alternate) subject counts that
+  produce that sample size
+
+  See compute_combinatorial_uniques() in process.h.
+ */
+typedef std::vector<
+    std::map<std::pair<unsigned, unsigned>,
+             std::map<std::string, std::pair<unsigned, unsigned> > > >
+    combinatorial_counts;
+
+/*!
+  \brief a single parsed row of SAIGE output for one comparison
+ */
+struct comparison_record {
+  comparison_record() : beta(0.0), pvalue(0.0), n(0, 0) {}
+  std::vector<std::string> annotation;  //!< first six columns, verbatim
+  std::string variant_id;               //!< SNP ID with sorted alleles
+  double beta;                          //!< effect estimate
+  double pvalue;                        //!< association p-value
+  std::pair<unsigned, unsigned> n;      //!< cases and controls
+};
+
+/*!
+  \brief a single combined output row
+ */
+struct combined_record {
+  combined_record() : min_p(1.0), consensus_p(1.0), n(0) {}
+  std::vector<std::string> annotation;  //!< annotation from first comparison
+  std::vector<double> betas;            //!< effect estimate per comparison
+  std::vector<double> pvalues;          //!< p-value per comparison
+  double min_p;                         //!< smallest comparison p-value
+  double consensus_p;                   //!< combined p-value
+  unsigned n;                           //!< unique sample size
+  std::vector<std::string> datasets;    //!< datasets counted toward n
+};
+
+/*!
+  \brief parse only the variant ID columns of a line of SAIGE output
+  @param line line to parse
+  @param source_name name of input, used in error messages
+  @param variant_id pointer to storage for SNP ID with sorted alleles
+
+  This is enough to decide consensus membership, so rows that will be
+  discarded need not have valid statistics.
+ */
+void parse_variant_id(const std::string &line, const std::string &source_name,
+                      std::string *variant_id);
+
+/*!
+  \brief parse a line of SAIGE output
+  @param line line to parse
+  @param source_name name of input, used in error messages
+  @param record pointer to storage for parsed record
+ */
+void parse_comparison_record(const std::string &line,
+                             const std::string &source_name,
+                             comparison_record *record);
+
+/*!
+  \brief count variant IDs of one input's records toward a consensus filter
+  @param records every record of one input
+  @param target running count of variant IDs; updated
+
+  Call once per input, then construct a map_consensus_filter from the
+  counts, to combine records held in memory. For raw text, count the IDs
+  from parse_variant_id() instead.
+ */
+void count_variant_ids(const std::vector<comparison_record> &records,
+                       std::map<std::string, unsigned> *target);
+
+/*!
+  \brief compute consensus p-value from the smallest of several p-values
+  @param min_p smallest p-value
+  @param n_valid number of p-values considered
+  \return 1 - (1 - min_p)^n_valid, with extended precision for small min_p
+ */
+double compute_consensus_p(double min_p, unsigned n_valid);
+
+/*!
+  \brief add one comparison's contribution to a unique sample size
+  @param comparison_number comparison number of the contribution
+  @param input_n cases and controls reported for the comparison
+  @param counts combinatorial sample size lookup
+  @param tracked_datasets datasets already counted; updated
+  @param unique_sample_size running sample size; updated
+
+  Datasets already counted by a prior comparison only contribute their
+  alternate condition subjects.
+ */
+void add_unique_sample_size(unsigned comparison_number,
+                            const std::pair<unsigned, unsigned> &input_n,
+                            const combinatorial_counts &counts,
+                            std::map<std::string, bool> *tracked_datasets,
+                            unsigned *unique_sample_size);
+
+/*!
+  \brief format datasets as a comma-separated list
+  @param tracked_datasets datasets to format
+  \return comma-separated dataset names
+ */
+std::string format_tracked_datasets(
+    const std::map<std::string, bool> &tracked_datasets);
+
+/*!
+  \brief format header for combined output
+  @param comparison_numbers comparison number of each input, in output
+  column order; each BETA_COMP and P_COMP column is named for its comparison
+  @param report_datasets whether to include DATASETS column
+  @param filtered whether rows may have been withheld from the output; if
+  so, the dataset column is named FILTERED_DATASETS, so the file is not
+  later mistaken for complete output
+  \return tab-delimited header line
+ */
+std::string format_combined_header(
+    const std::vector<unsigned> &comparison_numbers, bool report_datasets,
+    bool filtered = false);
+
+/*!
+  \brief format a combined record as an output line
+  @param record record to format
+  @param report_datasets whether to include DATASETS column; if so, the
+  output can later be extended in incremental mode, so effect estimates and
+  p-values are written with enough digits to be read back exactly
+  \return tab-delimited line
+ */
+std::string format_combined_record(const combined_record &record,
+                                   bool report_datasets);
+
+/*!
+  \class combiner
+  \brief combine per-comparison record streams into consensus records
+
+  Each input is a stream of comparison records in a shared variant order.
+  Records can be pushed, either parsed or as raw text, or pulled from
+  caller-supplied sources. Whenever every input has a record available or
+  has finished, the next variant is resolved; variants present in all
+  inputs are reported through the record callback.
+
+  Variants are matched in lockstep, so inputs only stay aligned once the
+  consensus filter has removed variants missing from any input. A filter is
+  therefore required; see count_variant_ids() for building one from records
+  in memory.
+ */
+class combiner {
+ public:
+  /*!
+    \brief callback receiving each combined record
+   */
+  typedef std::function<void(const combined_record &)> record_callback;
+  /*!
+    \brief optional predicate applied before sample size resolution
+    \return whether the record should be completed and reported
+
+    Only annotation and p-value fields are set when this is called.
+   */
+  typedef std::function<bool(const combined_record &)> record_predicate;
+  /*!
+    \brief source of records for pull mode
+    \return whether a record was provided; false once exhausted
+   */
+  typedef std::function<bool(comparison_record *)> record_source;
+  /*!
+    \brief source of raw SAIGE data lines for pull mode
+    \return whether a line was provided; false once exhausted
+
+    Lines are parsed only as far as needed: rows rejected by the consensus
+    filter are never fully parsed.
+   */
+  typedef std::function<bool(std::string *)> line_source;
+
+  /*!
+    \brief constructor
+    @param comparison_numbers comparison number of each input, in output
+    column order
+    @param counts combinatorial sample size lookup; copied, so it need not
+    outlive the combiner
+    @param callback destination of combined records
+    @param consensus filter restricting inputs to consensus variants; not
+    owned; must outlive the combiner
+   */
+  combiner(const std::vector<unsigned> &comparison_numbers,
+           const combinatorial_counts &counts, const record_callback &callback,
+           consensus_filter *consensus);
+  /*!
+    \brief destructor
+   */
+  ~combiner() throw() {}
+
+  /*!
+    \brief set predicate to skip records before sample size resolution
+    @param predicate predicate; records for which it is false are dropped
+   */
+  void set_predicate(const record_predicate &predicate) {
+    _predicate = predicate;
+  }
+  /*!
+    \brief set names of inputs for use in parse error messages
+    @param names one name per input, such as its filename
+   */
+  void set_source_names(const std::vector<std::string> &names);
+
+  /*!
+    \brief push a parsed record for one input
+    @param input_index index of input
+    @param record record for the input's next line
+   */
+  void push(unsigned input_index, const comparison_record &record);
+  /*!
+    \brief push raw SAIGE output text for one input
+    @param input_index index of input
+    @param buffer text; may begin or end mid-line
+
+    The first line pushed for each input is treated as the header and
+    skipped.
+   */
+  void push_buffer(unsigned input_index, const std::string &buffer);
+  /*!
+    \brief mark an input as complete
+    @param input_index index of input
+
+    Any partial line pushed with push_buffer is processed first.
+   */
+  void finish(unsigned input_index);
+  /*!
+    \brief pull records from sources until all are exhausted
+    @param sources one source per input
+
+    Each source is only read when its input needs a record, so at most one
+    record per input is held at a time.
+   */
+  void pull(const std::vector<record_source> &sources);
+  /*!
+    \brief pull raw data lines from sources until all are exhausted
+    @param sources one source per input, each yielding data lines with any
+    header already consumed
+
+    As with pull(), each source is only read when its input needs a record.
+   */
+  void pull_lines(const std::vector<line_source> &sources);
+  /*!
+    \brief report whether all inputs have finished and been fully processed
+    \return whether combination is complete
+   */
+  bool complete() const;
+
+ private:
+  /*!
+    \brief per-input stream state
+   */
+  struct input_state {
+    input_state() : has_current(false), finished(false), header_seen(false) {}
+    std::deque<comparison_record> queued;  //!< pushed, not yet current
+    comparison_record current;             //!< record under consideration
+    bool has_current;                      //!< whether current is unconsumed
+    bool finished;                         //!< whether input is complete
+    bool header_seen;                      //!< whether header was skipped
+    std::string partial_line;              //!< incomplete pushed text
+  };
+  void push_line(unsigned input_index, const std::string &line);
+  void push_data_line(unsigned input_index, const std::string &line);
+  bool admit(unsigned input_index, const std::string &variant_id);
+  void pull_until_complete(const std::function<bool(unsigned)> &advance);
+  bool ready() const;
+  void resolve_available();
+  void resolve_step();
+  std::string source_name(unsigned input_index) const;
+
+  std::vector<unsigned> _comparison_numbers;  //!< comparison of each input
+  combinatorial_counts _counts;               //!< sample size lookup
+  record_callback _callback;                  //!< combined record destination
+  record_predicate _predicate;                //!< optional early filter
+  consensus_filter *_consensus;               //!< consensus filter
+  std::vector<input_state> _inputs;           //!< stream state per input
+  std::vector<std::string> _source_names;     //!< optional input names
+};
+}  // namespace combine_categorical_runs
+
+#endif  // COMBINE_CATEGORICAL_RUNS_COMBINER_H_
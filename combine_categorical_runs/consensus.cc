@@ -0,0 +1,402 @@
+/*!
+  \file consensus.cc
+  \brief method implementation for consensus variant filters
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include "combine_categorical_runs/consensus.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include "boost/filesystem.hpp"
+#include "combine_categorical_runs/external_sorter.h"
+#include "combine_categorical_runs/line_reader.h"
+
+namespace {
+/*!
+  \brief single observation of a variant ID in an input file
+ */
+struct variant_occurrence {
+  std::string id;
+  unsigned file_index;
+  unsigned long line_index;
+  bool operator<(const variant_occurrence &obj) const {
+    if (id.compare(obj.id)) return id < obj.id;
+    if (file_index != obj.file_index) return file_index < obj.file_index;
+    return line_index < obj.line_index;
+  }
+  unsigned long memory_footprint() const {
+    return combine_categorical_runs::string_heap_footprint(id);
+  }
+};
+
+std::ostream &operator<<(std::ostream &out, const variant_occurrence &obj) {
+  return out << obj.id << '\t' << obj.file_index << '\t' << obj.line_index;
+}
+
+std::istream &operator>>(std::istream &in, variant_occurrence &obj) {
+  return in >> obj.id >> obj.file_index >> obj.line_index;
+}
+
+/*!
+  \brief position of a retained line in an input file
+ */
+struct line_reference {
+  unsigned file_index;
+  unsigned long line_index;
+  bool operator<(const line_reference &obj) const {
+    if (file_index != obj.file_index) return file_index < obj.file_index;
+    return line_index < obj.line_index;
+  }
+  unsigned long memory_footprint() const { return 0; }
+};
+
+std::ostream &operator<<(std::ostream &out, const line_reference &obj) {
+  return out << obj.file_index << '\t' << obj.line_index;
+}
+
+std::istream &operator>>(std::istream &in, line_reference &obj) {
+  return in >> obj.file_index >> obj.line_index;
+}
+
+std::string retained_list_name(const std::string &directory, unsigned index) {
+  std::ostringstream o;
+  o << directory << "/retained" << index;
+  return o.str();
+}
+}  // namespace
+
+void combine_categorical_runs::scan_variant_ids(
+    const std::string &filename,
+    const std::function<void(const std::string &)> &callback,
+    unsigned decompression_threads) {
+  line_reader *input = 0;
+  std::string line = "", id = "", catcher = "", a1 = "", a2 = "";
+  try {
+    input = open_line_reader(filename, decompression_threads);
+    input->getline(&line);
+    while (input->getline(&line)) {
+      std::istringstream strm1(line);
+      if (!(strm1 >> catcher >> catcher >> id >> a1 >> a2))
+        throw std::domain_error("cannot parse file \"" + filename +
+                                "\" line \"" + line + "\"");
+      id = id + ":" + (a1 < a2 ? a1 : a2) + ":" + (a1 < a2 ? a2 : a1);
+      callback(id);
+    }
+    input->close();
+    delete input;
+    input = 0;
+  } catch (...) {
+    if (input) delete input;
+    throw;
+  }
+}
+
+combine_categorical_runs::partitioned_consensus_filter::
+    partitioned_consensus_filter(
+        const std::vector<std::string> &input_filenames, unsigned n_threads,
+        unsigned decompression_threads) {
+  if (!n_threads) n_threads = 1;
+  // each worker scans whole files into its own sorted runs of bounded size,
+  // so no run is ever reallocated past its first allocation
+  std::vector<std::vector<std::vector<std::string> > > local(n_threads);
+  std::vector<std::exception_ptr> errors(n_threads);
+  std::atomic<unsigned> next_file(0);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < n_threads; ++t) {
+    workers.push_back(std::thread([&, t]() {
+      try {
+        std::vector<std::vector<std::string> > &runs = local.at(t);
+        unsigned i = 0;
+        while ((i = next_file++) < input_filenames.size()) {
+          scan_variant_ids(
+              input_filenames.at(i),
+              [&runs](const std::string &id) {
+                if (runs.empty() || runs.back().size() == _run_size) {
+                  if (!runs.empty())
+                    std::sort(runs.back().begin(), runs.back().end());
+                  runs.push_back(std::vector<std::string>());
+                  runs.back().reserve(_run_size);
+                }
+                runs.back().push_back(id);
+              },
+              decompression_threads);
+        }
+        if (!runs.empty()) std::sort(runs.back().begin(), runs.back().end());
+      } catch (...) {
+        errors.at(t) = std::current_exception();
+      }
+    }));
+  }
+  for (unsigned t = 0; t < n_threads; ++t) workers.at(t).join();
+  for (unsigned t = 0; t < n_threads; ++t) {
+    if (errors.at(t)) std::rethrow_exception(errors.at(t));
+  }
+  std::vector<std::vector<std::string> > runs;
+  for (unsigned t = 0; t < n_threads; ++t) {
+    for (unsigned r = 0; r < local.at(t).size(); ++r) {
+      runs.push_back(std::vector<std::string>());
+      runs.back().swap(local.at(t).at(r));
+    }
+  }
+  // split the key space at quantiles of a sample drawn evenly from every run
+  std::vector<std::string> sample;
+  for (unsigned r = 0; r < runs.size(); ++r) {
+    for (unsigned j = 0; j < runs.at(r).size(); j += _run_size / 64) {
+      sample.push_back(runs.at(r).at(j));
+    }
+  }
+  std::sort(sample.begin(), sample.end());
+  for (unsigned p = 1; p < n_threads && !sample.empty(); ++p) {
+    const std::string &splitter = sample.at(sample.size() * p / n_threads);
+    if (_splitters.empty() || _splitters.back() < splitter)
+      _splitters.push_back(splitter);
+  }
+  std::vector<std::string>().swap(sample);
+  // merge each key range independently; ranges share no keys
+  unsigned n_files = input_filenames.size();
+  _partitions.resize(_splitters.size() + 1);
+  errors.assign(_partitions.size(), std::exception_ptr());
+  workers.clear();
+  for (unsigned p = 0; p < _partitions.size(); ++p) {
+    workers.push_back(std::thread([&, p]() {
+      try {
+        typedef std::vector<std::string>::const_iterator run_iterator;
+        typedef std::pair<run_iterator, run_iterator> cursor;
+        std::vector<cursor> cursors;
+        auto later = [](const cursor &a, const cursor &b) {
+          return *b.first < *a.first;
+        };
+        for (unsigned r = 0; r < runs.size(); ++r) {
+          const std::vector<std::string> &run = runs.at(r);
+          run_iterator begin =
+              p ? std::lower_bound(run.begin(), run.end(), _splitters.at(p - 1))
+                : run.begin();
+          run_iterator end =
+              p < _splitters.size()
+                  ? std::lower_bound(begin, run.end(), _splitters.at(p))
+                  : run.end();
+          if (begin != end) cursors.push_back(std::make_pair(begin, end));
+        }
+        // count the consensus IDs of the range first, so its storage is
+        // allocated exactly once
+        std::vector<std::string> &target = _partitions.at(p);
+        unsigned long n_consensus = 0;
+        for (unsigned pass = 0; pass < 2; ++pass) {
+          std::vector<cursor> heap(cursors);
+          // min-heap of cursors by current key
+          std::make_heap(heap.begin(), heap.end(), later);
+          while (!heap.empty()) {
+            const std::string &id = *heap.front().first;
+            unsigned count = 0;
+            while (!heap.empty() && !heap.front().first->compare(id)) {
+              ++count;
+              std::pop_heap(heap.begin(), heap.end(), later);
+              if (++heap.back().first == heap.back().second) {
+                heap.pop_back();
+              } else {
+                std::push_heap(heap.begin(), heap.end(), later);
+              }
+            }
+            if (count != n_files) continue;
+            if (pass) {
+              target.push_back(id);
+            } else {
+              ++n_consensus;
+            }
+          }
+          if (!pass) target.reserve(n_consensus);
+        }
+      } catch (...) {
+        errors.at(p) = std::current_exception();
+      }
+    }));
+  }
+  for (unsigned p = 0; p < _partitions.size(); ++p) workers.at(p).join();
+  for (unsigned p = 0; p < _partitions.size(); ++p) {
+    if (errors.at(p)) std::rethrow_exception(errors.at(p));
+  }
+}
+
+bool combine_categorical_runs::partitioned_consensus_filter::retain(
+    unsigned file_index, const std::string &variant_id) {
+  const std::vector<std::string> &partition = _partitions.at(
+      std::upper_bound(_splitters.begin(), _splitters.end(), variant_id) -
+      _splitters.begin());
+  return std::binary_search(partition.begin(), partition.end(), variant_id);
+}
+
+unsigned long combine_categorical_runs::partitioned_consensus_filter::
+    complete_variant_count() const {
+  unsigned long res = 0;
+  for (unsigned p = 0; p < _partitions.size(); ++p) {
+    res += _partitions.at(p).size();
+  }
+  return res;
+}
+
+bool combine_categorical_runs::map_consensus_filter::retain(
+    unsigned file_index, const std::string &variant_id) {
+  std::map<std::string, unsigned>::const_iterator finder =
+      _consensus_variants.find(variant_id);
+  return finder != _consensus_variants.end() && finder->second == _n_files;
+}
+
+unsigned long
+combine_categorical_runs::map_consensus_filter::complete_variant_count() const {
+  unsigned long res = 0;
+  for (std::map<std::string, unsigned>::const_iterator iter =
+           _consensus_variants.begin();
+       iter != _consensus_variants.end(); ++iter) {
+    if (iter->second == _n_files) ++res;
+  }
+  return res;
+}
+
+combine_categorical_runs::spilled_consensus_filter::spilled_consensus_filter(
+    const std::vector<std::string> &input_filenames, unsigned long max_bytes,
+    const std::string &scratch_directory, unsigned decompression_threads)
+    : _complete_variant_count(0) {
+  boost::filesystem::path scratch_root =
+      scratch_directory.empty() ? boost::filesystem::temp_directory_path()
+                                : boost::filesystem::path(scratch_directory);
+  boost::filesystem::path scratch_name =
+      boost::filesystem::unique_path("combine_categorical_runs-%%%%-%%%%-%%%%");
+  _scratch_directory = (scratch_root / scratch_name).string();
+  boost::filesystem::create_directories(_scratch_directory);
+  try {
+    // sort every variant occurrence by ID
+    combine_categorical_runs::external_sorter<variant_occurrence> by_id(
+        _scratch_directory + "/ids", max_bytes);
+    variant_occurrence occurrence;
+    for (unsigned i = 0; i < input_filenames.size(); ++i) {
+      occurrence.file_index = i;
+      occurrence.line_index = 0;
+      scan_variant_ids(input_filenames.at(i),
+                       [&by_id, &occurrence](const std::string &id) {
+                         occurrence.id = id;
+                         by_id.push(occurrence);
+                         ++occurrence.line_index;
+                       },
+                       decompression_threads);
+    }
+    // the line sorter fills while IDs are still being read back, so the two
+    // share the budget. IDs that never spilled are written out if they would
+    // leave the line sorter less than half of it
+    if (!by_id.spilled() && by_id.memory_usage() > max_bytes / 2)
+      by_id.release_memory();
+    by_id.finalize();
+    unsigned long id_bytes = by_id.spilled() ? 0 : by_id.memory_usage();
+    // walk each ID group; if the ID is present once per file, queue its lines
+    // for retention. groups larger than the file count can be discarded
+    // without being held in memory
+    combine_categorical_runs::external_sorter<line_reference> by_line(
+        _scratch_directory + "/lines", max_bytes - id_bytes);
+    std::vector<line_reference> group;
+    std::string group_id = "";
+    unsigned long group_size = 0;
+    bool more = true;
+    while (more) {
+      more = by_id.pop(&occurrence);
+      if (!more || occurrence.id.compare(group_id)) {
+        if (group_size == input_filenames.size()) {
+          for (std::vector<line_reference>::const_iterator iter = group.begin();
+               iter != group.end(); ++iter) {
+            by_line.push(*iter);
+          }
+          ++_complete_variant_count;
+        }
+        group.clear();
+        group_size = 0;
+        group_id = occurrence.id;
+      }
+      if (!more) break;
+      ++group_size;
+      if (group.size() <= input_filenames.size()) {
+        line_reference ref;
+        ref.file_index = occurrence.file_index;
+        ref.line_index = occurrence.line_index;
+        group.push_back(ref);
+      }
+    }
+    // split retained lines into one ordered list per file
+    std::vector<std::ofstream *> outputs(input_filenames.size(), 0);
+    try {
+      for (unsigned i = 0; i < outputs.size(); ++i) {
+        outputs.at(i) = new std::ofstream(
+            retained_list_name(_scratch_directory, i).c_str());
+        if (!outputs.at(i)->is_open())
+          throw std::runtime_error(
+              "spilled_consensus_filter: cannot write to scratch directory \"" +
+              _scratch_directory + "\"");
+      }
+      line_reference ref;
+      while (by_line.pop(&ref)) {
+        if (!(*outputs.at(ref.file_index) << ref.line_index << '\n'))
+          throw std::runtime_error(
+              "spilled_consensus_filter: write failure in scratch directory "
+              "\"" +
+              _scratch_directory + "\"");
+      }
+      for (unsigned i = 0; i < outputs.size(); ++i) {
+        outputs.at(i)->close();
+        delete outputs.at(i);
+        outputs.at(i) = 0;
+      }
+    } catch (...) {
+      for (unsigned i = 0; i < outputs.size(); ++i) {
+        if (outputs.at(i)) delete outputs.at(i);
+      }
+      throw;
+    }
+    _lists.resize(input_filenames.size(), 0);
+    _line_index.resize(input_filenames.size(), 0);
+    _next_retained.resize(input_filenames.size(), 0);
+    _exhausted.resize(input_filenames.size(), false);
+    for (unsigned i = 0; i < _lists.size(); ++i) {
+      _lists.at(i) =
+          new std::ifstream(retained_list_name(_scratch_directory, i).c_str());
+      if (!_lists.at(i)->is_open())
+        throw std::runtime_error(
+            "spilled_consensus_filter: cannot read from scratch directory \"" +
+            _scratch_directory + "\"");
+      _exhausted.at(i) = !(*_lists.at(i) >> _next_retained.at(i));
+    }
+  } catch (...) {
+    close_lists();
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(_scratch_directory, ec);
+    throw;
+  }
+}
+
+combine_categorical_runs::spilled_consensus_filter::
+    ~spilled_consensus_filter() throw() {
+  close_lists();
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(_scratch_directory, ec);
+}
+
+void combine_categorical_runs::spilled_consensus_filter::close_lists() throw() {
+  for (unsigned i = 0; i < _lists.size(); ++i) {
+    if (_lists.at(i)) delete _lists.at(i);
+    _lists.at(i) = 0;
+  }
+}
+
+bool combine_categorical_runs::spilled_consensus_filter::retain(
+    unsigned file_index, const std::string &variant_id) {
+  unsigned long current = _line_index.at(file_index)++;
+  if (_exhausted.at(file_index) || _next_retained.at(file_index) != current)
+    return false;
+  _exhausted.at(file_index) =
+      !(*_lists.at(file_index) >> _next_retained.at(file_index));
+  return true;
+}
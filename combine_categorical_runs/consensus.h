@@ -0,0 +1,187 @@
+/*!
+ \file consensus.h
+ \brief detection of variants present in every input file
+ \copyright Released under the MIT License.
+ Copyright 2021 Cameron Palmer
+ */
+
+#ifndef COMBINE_CATEGORICAL_RUNS_CONSENSUS_H_
+#define COMBINE_CATEGORICAL_RUNS_CONSENSUS_H_
+
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace combine_categorical_runs {
+/*!
+  \brief call a function with the allele-sorted variant ID of each data line
+  of a SAIGE output file
+  @param filename SAIGE output file
+  @param callback function to call for each line
+  @param decompression_threads threads for decompressing gzip input
+ */
+void scan_variant_ids(const std::string &filename,
+                      const std::function<void(const std::string &)> &callback,
+                      unsigned decompression_threads = 1);
+
+/*!
+  \class consensus_filter
+  \brief interface for deciding whether an input line belongs to the consensus
+  variant set
+
+  retain() must be called exactly once for each data line of each input file,
+  in file order, as implementations may track position within each file.
+ */
+class consensus_filter {
+ public:
+  /*!
+    \brief destructor
+   */
+  virtual ~consensus_filter() throw() {}
+  /*!
+    \brief determine whether the next line of an input file should be kept
+    @param file_index index of input file in the order provided
+    @param variant_id allele-sorted variant ID for the line
+    \return whether the line's variant is present in all files
+   */
+  virtual bool retain(unsigned file_index, const std::string &variant_id) = 0;
+  /*!
+    \brief report number of distinct variants present in all files
+    \return number of distinct variants present in all files
+   */
+  virtual unsigned long complete_variant_count() const = 0;
+};
+
+/*!
+  \class map_consensus_filter
+  \brief consensus filter backed by an in-memory count of every variant ID
+ */
+class map_consensus_filter : public consensus_filter {
+ public:
+  /*!
+    \brief constructor
+    @param consensus_variants count of occurrences of each variant ID across
+    all input files
+    @param n_files number of input files
+   */
+  map_consensus_filter(
+      const std::map<std::string, unsigned> &consensus_variants,
+      unsigned n_files)
+      : _consensus_variants(consensus_variants), _n_files(n_files) {}
+  /*!
+    \brief destructor
+   */
+  ~map_consensus_filter() throw() {}
+  bool retain(unsigned file_index, const std::string &variant_id);
+  unsigned long complete_variant_count() const;
+
+ private:
+  const std::map<std::string, unsigned>
+      &_consensus_variants;  //!< variant ID counts
+  unsigned _n_files;         //!< required count for consensus
+};
+
+/*!
+  \class partitioned_consensus_filter
+  \brief consensus filter counted in parallel across input files
+
+  Worker threads each scan whole input files, collecting variant IDs into
+  fixed-size sorted runs. The runs are then split into key ranges, and each
+  range is merged across all runs on its own thread, keeping only IDs that
+  reach the consensus count. Runs hold one string per variant occurrence in
+  contiguous storage, without per-entry nodes, so peak memory does not grow
+  with the thread count: about sizeof(std::string) per input line, against
+  roughly two and a half times that per distinct ID for map_consensus_filter.
+  Only consensus IDs remain once construction completes.
+ */
+class partitioned_consensus_filter : public consensus_filter {
+ public:
+  /*!
+    \brief constructor; scans all inputs and counts variant IDs
+    @param input_filenames SAIGE output files to scan
+    @param n_threads number of worker threads and key ranges
+    @param decompression_threads threads for decompressing each gzip input
+   */
+  partitioned_consensus_filter(const std::vector<std::string> &input_filenames,
+                               unsigned n_threads,
+                               unsigned decompression_threads = 1);
+  /*!
+    \brief destructor
+   */
+  ~partitioned_consensus_filter() throw() {}
+  bool retain(unsigned file_index, const std::string &variant_id);
+  unsigned long complete_variant_count() const;
+
+ private:
+  static const unsigned _run_size = 65536;  //!< variant IDs per sorted run
+  std::vector<std::string> _splitters;  //!< first key of each later range
+  std::vector<std::vector<std::string> >
+      _partitions;  //!< sorted consensus IDs of each key range
+};
+
+/*!
+  \class spilled_consensus_filter
+  \brief consensus filter computed with bounded memory via external sorting
+
+  Every (variant ID, file, line) occurrence is sorted on disk by variant ID.
+  Lines whose ID occurs once per input file are then sorted by file and line
+  and written to one list per input file, which retain() streams in lockstep
+  with the caller's pass over the inputs. Both sorts run within the same
+  budget: the second only gets what the first leaves resident.
+ */
+class spilled_consensus_filter : public consensus_filter {
+ public:
+  /*!
+    \brief constructor; scans all inputs and builds per-file retained line
+    lists
+    @param input_filenames SAIGE output files to scan
+    @param max_bytes approximate memory budget for sorting
+    @param scratch_directory directory in which to create temporary files, or
+    "" for the system temporary directory
+    @param decompression_threads threads for decompressing each gzip input
+   */
+  spilled_consensus_filter(const std::vector<std::string> &input_filenames,
+                           unsigned long max_bytes,
+                           const std::string &scratch_directory,
+                           unsigned decompression_threads = 1);
+  /*!
+    \brief destructor; removes temporary files
+   */
+  ~spilled_consensus_filter() throw();
+  bool retain(unsigned file_index, const std::string &variant_id);
+  unsigned long complete_variant_count() const {
+    return _complete_variant_count;
+  }
+
+ private:
+  /*!
+    \brief default constructor
+    \warning disabled
+   */
+  spilled_consensus_filter() {
+    throw std::domain_error(
+        "spilled_consensus_filter: do not use default constructor");
+  }
+  /*!
+    \brief copy constructor
+    \warning disabled
+   */
+  spilled_consensus_filter(const spilled_consensus_filter &obj) {
+    throw std::domain_error(
+        "spilled_consensus_filter: do not use copy constructor");
+  }
+  void close_lists() throw();
+  std::string _scratch_directory;        //!< private temporary directory
+  std::vector<std::ifstream *> _lists;   //!< retained lines for each file
+  std::vector<unsigned long> _line_index;  //!< current line of each file
+  std::vector<unsigned long> _next_retained;  //!< next retained line
+  std::vector<bool> _exhausted;          //!< whether each list is finished
+  unsigned long _complete_variant_count;  //!< distinct consensus variants
+};
+}  // namespace combine_categorical_runs
+
+#endif  // COMBINE_CATEGORICAL_RUNS_CONSENSUS_H_
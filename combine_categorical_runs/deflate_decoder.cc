@@ -0,0 +1,614 @@
+/*!
+  \file deflate_decoder.cc
+  \brief method implementation for block-boundary DEFLATE decoding
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include "combine_categorical_runs/deflate_decoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+const unsigned read_buffer_size = 1 << 20;  //!< compressed bytes per read
+const unsigned short length_base[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const unsigned char length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                        1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                        4, 4, 4, 4, 5, 5, 5, 5, 0};
+const unsigned short distance_base[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+const unsigned char distance_extra[30] = {0, 0, 0,  0,  1,  1,  2,  2,
+                                          3, 3, 4,  4,  5,  5,  6,  6,
+                                          7, 7, 8,  8,  9,  9,  10, 10,
+                                          11, 11, 12, 12, 13, 13};
+const unsigned char code_length_order[19] = {16, 17, 18, 0, 8,  7, 9,
+                                             6,  10, 5,  11, 4, 12, 3,
+                                             13, 2,  14, 1,  15};
+}  // namespace
+
+combine_categorical_runs::deflate_decoder::deflate_decoder(
+    const std::string &filename)
+    : _filename(filename),
+      _input(filename.c_str(), std::ios::binary),
+      _file_bits(0),
+      _buffer(read_buffer_size),
+      _buffer_offset(0),
+      _buffer_position(0),
+      _buffer_end(0),
+      _padding(0),
+      _eof(false),
+      _bits(0),
+      _n_bits(0),
+      _marking(false),
+      _marked_count(0),
+      _size(0),
+      _floor(0),
+      _last_marker(0) {
+  if (!_input.is_open())
+    throw std::runtime_error("deflate_decoder: cannot open file \"" +
+                             filename + "\"");
+  _input.seekg(0, std::ios::end);
+  _file_bits = static_cast<unsigned long long>(_input.tellg()) * 8;
+  _input.seekg(0, std::ios::beg);
+  unsigned char lengths[288];
+  for (unsigned i = 0; i < 288; ++i) {
+    lengths[i] = i < 144 ? 8 : (i < 256 ? 9 : (i < 280 ? 7 : 8));
+  }
+  build_huffman(lengths, 288, false, &_fixed_literals);
+  // codes 30 and 31 complete the fixed distance code but are never valid
+  std::fill(lengths, lengths + 32, 5);
+  build_huffman(lengths, 32, false, &_fixed_distances);
+}
+
+bool combine_categorical_runs::deflate_decoder::build_huffman(
+    const unsigned char *lengths, unsigned n, bool code_lengths,
+    huffman *code) {
+  std::memset(code->count, 0, sizeof(code->count));
+  for (unsigned s = 0; s < n; ++s) ++code->count[lengths[s]];
+  code->count[0] = 0;
+  unsigned max_length = 15;
+  while (max_length && !code->count[max_length]) --max_length;
+  // a code with no symbols is accepted, but decodes nothing
+  if (!max_length) {
+    std::memset(code->fast, 0, sizeof(code->fast));
+    return true;
+  }
+  // the same rules as zlib: never oversubscribed, and only incomplete when
+  // a literal or distance code has a single one-bit code
+  int left = 1;
+  for (unsigned len = 1; len <= 15; ++len) {
+    left <<= 1;
+    left -= code->count[len];
+    if (left < 0) return false;
+  }
+  if (left > 0 && (code_lengths || max_length != 1)) return false;
+  std::memset(code->fast, 0, sizeof(code->fast));
+  unsigned short offsets[16], next_code[16];
+  offsets[1] = 0;
+  next_code[0] = 0;
+  for (unsigned len = 1; len < 15; ++len) {
+    offsets[len + 1] = offsets[len] + code->count[len];
+  }
+  unsigned value = 0;
+  for (unsigned len = 1; len <= 15; ++len) {
+    value = (value + code->count[len - 1]) << 1;
+    next_code[len] = value;
+  }
+  for (unsigned s = 0; s < n; ++s) {
+    unsigned len = lengths[s];
+    if (!len) continue;
+    code->symbols[offsets[len]++] = s;
+    unsigned canonical = next_code[len]++;
+    if (len > fast_bits) continue;
+    // codes are stored most significant bit first
+    unsigned reversed = 0;
+    for (unsigned i = 0; i < len; ++i) {
+      reversed = (reversed << 1) | ((canonical >> i) & 1);
+    }
+    for (unsigned i = reversed; i < (1u << fast_bits); i += 1u << len) {
+      code->fast[i] = static_cast<unsigned short>((s << 4) | len);
+    }
+  }
+  return true;
+}
+
+void combine_categorical_runs::deflate_decoder::seek(unsigned long long bit) {
+  unsigned long long byte = bit >> 3;
+  if (byte >= _buffer_offset && byte < _buffer_offset + _buffer_end) {
+    _buffer_position = byte - _buffer_offset;
+  } else {
+    _input.clear();
+    _input.seekg(byte, std::ios::beg);
+    _buffer_offset = byte;
+    _buffer_position = 0;
+    _buffer_end = 0;
+    _eof = false;
+  }
+  _bits = 0;
+  _n_bits = 0;
+  _padding = 0;
+  refill();
+  _bits >>= bit & 7;
+  _n_bits -= bit & 7;
+}
+
+bool combine_categorical_runs::deflate_decoder::fill() {
+  if (_eof) return false;
+  _buffer_offset += _buffer_end;
+  _buffer_position = 0;
+  _input.read(reinterpret_cast<char *>(&_buffer[0]), _buffer.size());
+  _buffer_end = _input.gcount();
+  if (!_buffer_end) _eof = true;
+  return _buffer_end;
+}
+
+void combine_categorical_runs::deflate_decoder::refill() {
+  if (_n_bits <= 56 && _buffer_end - _buffer_position >= 8) {
+    // take whole bytes up to 56 or more bits; bits above _n_bits are the
+    // next bytes, so loading them again later leaves _bits unchanged
+    const unsigned char *data = &_buffer[_buffer_position];
+    unsigned long long word = 0;
+    for (unsigned i = 0; i < 8; ++i) {
+      word |= static_cast<unsigned long long>(data[i]) << (8 * i);
+    }
+    _bits |= word << _n_bits;
+    _buffer_position += (63 - _n_bits) >> 3;
+    _n_bits |= 56;
+    return;
+  }
+  while (_n_bits <= 56) {
+    if (_buffer_position == _buffer_end && !fill()) {
+      // zero bits past the end; overrun() reports if any are consumed
+      ++_padding;
+      _n_bits += 8;
+      continue;
+    }
+    _bits |= static_cast<unsigned long long>(_buffer[_buffer_position++])
+             << _n_bits;
+    _n_bits += 8;
+  }
+}
+
+unsigned long combine_categorical_runs::deflate_decoder::bits(unsigned n) {
+  if (_n_bits < n) refill();
+  unsigned long res = _bits & ((1ull << n) - 1);
+  _bits >>= n;
+  _n_bits -= n;
+  return res;
+}
+
+unsigned long combine_categorical_runs::deflate_decoder::peek(unsigned n) {
+  if (_n_bits < n) refill();
+  return _bits & ((1ull << n) - 1);
+}
+
+void combine_categorical_runs::deflate_decoder::align() {
+  _bits >>= _n_bits & 7;
+  _n_bits -= _n_bits & 7;
+}
+
+int combine_categorical_runs::deflate_decoder::decode_symbol(
+    const huffman &code) {
+  return decode_symbol(code, &_bits, &_n_bits);
+}
+
+int combine_categorical_runs::deflate_decoder::decode_symbol(
+    const huffman &code, unsigned long long *bits, unsigned *n_bits) {
+  unsigned entry = code.fast[*bits & ((1u << fast_bits) - 1)];
+  if (entry) {
+    *bits >>= entry & 15;
+    *n_bits -= entry & 15;
+    return entry >> 4;
+  }
+  // long or invalid codes, one bit at a time
+  int value = 0, first = 0, index = 0;
+  for (unsigned len = 1; len <= 15; ++len) {
+    value |= (*bits >> (len - 1)) & 1;
+    int count = code.count[len];
+    if (value - count < first) {
+      *bits >>= len;
+      *n_bits -= len;
+      return code.symbols[index + (value - first)];
+    }
+    index += count;
+    first = (first + count) << 1;
+    value <<= 1;
+  }
+  return -1;
+}
+
+combine_categorical_runs::deflate_decoder::status
+combine_categorical_runs::deflate_decoder::read_dynamic_header(
+    huffman *literals, huffman *distances) {
+  unsigned n_literals = bits(5) + 257;
+  unsigned n_distances = bits(5) + 1;
+  unsigned n_code_lengths = bits(4) + 4;
+  if (n_literals > 286 || n_distances > 30) return status_bad;
+  unsigned char code_length_lengths[19] = {0}, lengths[316] = {0};
+  for (unsigned i = 0; i < n_code_lengths; ++i) {
+    code_length_lengths[code_length_order[i]] = bits(3);
+  }
+  huffman code_lengths;
+  if (!build_huffman(code_length_lengths, 19, true, &code_lengths))
+    return status_bad;
+  unsigned index = 0;
+  while (index < n_literals + n_distances) {
+    if (_n_bits < 32) refill();
+    int symbol = decode_symbol(code_lengths);
+    if (symbol < 0) return status_bad;
+    if (symbol < 16) {
+      lengths[index++] = symbol;
+      continue;
+    }
+    unsigned char value = 0;
+    unsigned long repeat = 0;
+    if (symbol == 16) {
+      if (!index) return status_bad;
+      value = lengths[index - 1];
+      repeat = 3 + bits(2);
+    } else if (symbol == 17) {
+      repeat = 3 + bits(3);
+    } else {
+      repeat = 11 + bits(7);
+    }
+    if (index + repeat > n_literals + n_distances) return status_bad;
+    while (repeat--) lengths[index++] = value;
+  }
+  // a block must be able to end
+  if (!lengths[256]) return status_bad;
+  if (!build_huffman(lengths, n_literals, false, literals) ||
+      !build_huffman(lengths + n_literals, n_distances, false, distances))
+    return status_bad;
+  return overrun() ? status_truncated : status_ok;
+}
+
+combine_categorical_runs::deflate_decoder::status
+combine_categorical_runs::deflate_decoder::read_member_header() {
+  if (bits(8) != 31 || bits(8) != 139 || bits(8) != 8) return status_bad;
+  unsigned long flags = bits(8);
+  if (flags & 0xe0) return status_bad;
+  // modification time, extra flags and operating system
+  for (unsigned i = 0; i < 6; ++i) bits(8);
+  if (flags & 4) {
+    unsigned long extra_length = bits(16);
+    for (unsigned long i = 0; i < extra_length && !overrun(); ++i) bits(8);
+  }
+  // file name, then comment, each zero-terminated
+  for (unsigned long flag = 8; flag <= 16; flag <<= 1) {
+    if (flags & flag) {
+      while (bits(8) && !overrun()) {
+      }
+    }
+  }
+  if (flags & 2) bits(16);
+  return overrun() ? status_truncated : status_ok;
+}
+
+combine_categorical_runs::deflate_decoder::status
+combine_categorical_runs::deflate_decoder::check_next_header() {
+  unsigned long header = bits(3);
+  unsigned long type = header >> 1;
+  if (type == 3) return status_bad;
+  if (!type) {
+    align();
+    unsigned long length = bits(16);
+    unsigned long complement = bits(16);
+    if (length != (~complement & 0xffff)) return status_bad;
+  } else if (type == 2) {
+    return read_dynamic_header(&_literals, &_distances);
+  }
+  return overrun() ? status_truncated : status_ok;
+}
+
+template <class buffer_type>
+combine_categorical_runs::deflate_decoder::status
+combine_categorical_runs::deflate_decoder::decode_codes(
+    const huffman &literals, const huffman &distances, buffer_type *out) {
+  typedef typename buffer_type::value_type value_type;
+  const bool marking = sizeof(value_type) > 1;
+  // byte stores may alias members, so the hot state is kept in locals and
+  // written back whenever a member function needs it
+  unsigned long long bits = _bits;
+  unsigned n_bits = _n_bits;
+  unsigned long size = _size, last_marker = _last_marker, floor = _floor;
+  unsigned long capacity = out->size();
+  value_type *output = capacity ? &(*out)[0] : 0;
+  status result = status_ok;
+  while (true) {
+    // enough bits for the longest length and distance with extra bits
+    if (n_bits < 48) {
+      _bits = bits;
+      _n_bits = n_bits;
+      if (overrun()) {
+        result = status_truncated;
+        break;
+      }
+      refill();
+      bits = _bits;
+      n_bits = _n_bits;
+    }
+    if (capacity < size + 258) {
+      capacity = std::max<unsigned long>(2 * capacity, size + 258);
+      out->resize(capacity);
+      output = &(*out)[0];
+    }
+    int symbol = decode_symbol(literals, &bits, &n_bits);
+    if (symbol < 256) {
+      if (symbol < 0) {
+        result = status_bad;
+        break;
+      }
+      output[size++] = static_cast<value_type>(symbol);
+    } else if (symbol == 256) {
+      break;
+    } else {
+      symbol -= 257;
+      if (symbol >= 29) {
+        result = status_bad;
+        break;
+      }
+      unsigned length =
+          length_base[symbol] + (bits & ((1u << length_extra[symbol]) - 1));
+      bits >>= length_extra[symbol];
+      n_bits -= length_extra[symbol];
+      int code = decode_symbol(distances, &bits, &n_bits);
+      if (code < 0 || code >= 30) {
+        result = status_bad;
+        break;
+      }
+      unsigned long distance =
+          distance_base[code] + (bits & ((1u << distance_extra[code]) - 1));
+      bits >>= distance_extra[code];
+      n_bits -= distance_extra[code];
+      if (distance > size - floor) {
+        result = status_bad;
+        break;
+      }
+      value_type *target = output + size;
+      const value_type *source = target - distance;
+      if (marking) {
+        for (unsigned i = 0; i < length; ++i) {
+          target[i] = source[i];
+          if (static_cast<unsigned>(target[i]) >= marker_base)
+            last_marker = size + i + 1;
+        }
+      } else if (distance >= length) {
+        std::memcpy(target, source, length);
+      } else {
+        // overlapping copies repeat the most recent output
+        for (unsigned i = 0; i < length; ++i) target[i] = source[i];
+      }
+      size += length;
+    }
+    if (marking && size - last_marker >= window_size) {
+      result = status_switch;
+      break;
+    }
+  }
+  _bits = bits;
+  _n_bits = n_bits;
+  _size = size;
+  _last_marker = last_marker;
+  if (result == status_ok && overrun()) result = status_truncated;
+  return result;
+}
+
+combine_categorical_runs::deflate_decoder::status
+combine_categorical_runs::deflate_decoder::decode_block(
+    const huffman &literals, const huffman &distances) {
+  status result = _marking ? decode_codes(literals, distances, &_marked)
+                           : decode_codes(literals, distances, &_bytes);
+  if (result == status_switch) {
+    switch_to_bytes();
+    result = decode_codes(literals, distances, &_bytes);
+  }
+  return result;
+}
+
+combine_categorical_runs::deflate_decoder::status
+combine_categorical_runs::deflate_decoder::copy_stored() {
+  align();
+  unsigned long length = bits(16);
+  unsigned long complement = bits(16);
+  if (length != (~complement & 0xffff)) return status_bad;
+  for (unsigned long i = 0; i < length; ++i) {
+    if (overrun()) return status_truncated;
+    unsigned long value = bits(8);
+    if (_marking) {
+      if (_marked.size() <= _size) _marked.resize(2 * _size + 1);
+      _marked[_size++] = value;
+    } else {
+      if (_bytes.size() <= _size) _bytes.resize(2 * _size + 1);
+      _bytes[_size++] = static_cast<char>(value);
+    }
+  }
+  if (_marking && _size - _last_marker >= window_size) switch_to_bytes();
+  return overrun() ? status_truncated : status_ok;
+}
+
+void combine_categorical_runs::deflate_decoder::start_output(
+    const std::string *window) {
+  _size = window_size;
+  _marked_count = 0;
+  _marking = !window;
+  if (_marking) {
+    // the unknown window is a marker for each of its positions
+    _marked.resize(window_size);
+    for (unsigned i = 0; i < window_size; ++i) _marked[i] = marker_base + i;
+    _floor = 0;
+    _last_marker = window_size;
+  } else {
+    _bytes.assign(window_size, '\0');
+    std::string::size_type known = std::min<std::string::size_type>(
+        window->size(), window_size);
+    std::memcpy(&_bytes[window_size - known],
+                window->data() + window->size() - known, known);
+    _floor = window_size - known;
+  }
+}
+
+void combine_categorical_runs::deflate_decoder::switch_to_bytes() {
+  // the last window_size values hold no markers, so they are plain bytes
+  unsigned long shift = _size - window_size;
+  _marked_count = shift;
+  _bytes.resize(window_size);
+  for (unsigned i = 0; i < window_size; ++i) {
+    _bytes[i] = static_cast<char>(_marked[shift + i]);
+  }
+  _marked.resize(_size);
+  _floor = _floor > shift ? _floor - shift : 0;
+  _size = window_size;
+  _marking = false;
+}
+
+unsigned long combine_categorical_runs::deflate_decoder::output_size() const {
+  return _marking ? _size - window_size : _marked_count + _size - window_size;
+}
+
+void combine_categorical_runs::deflate_decoder::fail(status result) const {
+  throw std::runtime_error(
+      std::string("deflate_decoder: ") +
+      (result == status_truncated ? "truncated" : "corrupt") +
+      " gzip data in \"" + _filename + "\"");
+}
+
+bool combine_categorical_runs::deflate_decoder::find_block(
+    unsigned long long from_bit, unsigned long long to_bit,
+    unsigned long long *found) {
+  if (!found)
+    throw std::domain_error("deflate_decoder::find_block: null pointer");
+  for (unsigned long long byte = from_bit >> 3;
+       byte << 3 < to_bit && byte << 3 < _file_bits; ++byte) {
+    seek(byte << 3);
+    // every bit offset within the byte is screened from one load
+    unsigned long word = peek(24);
+    for (unsigned shift = 0; shift < 8; ++shift) {
+      unsigned long long bit = (byte << 3) + shift;
+      if (bit < from_bit || bit >= to_bit) continue;
+      // a non-final dynamic block, with no more codes than DEFLATE defines
+      unsigned long header = word >> shift;
+      if ((header & 7) != 4 || ((header >> 3) & 31) > 29 ||
+          ((header >> 8) & 31) > 29)
+        continue;
+      seek(bit);
+      bits(3);
+      if (read_dynamic_header(&_literals, &_distances) != status_ok) continue;
+      start_output(0);
+      if (decode_block(_literals, _distances) != status_ok ||
+          check_next_header() != status_ok)
+        continue;
+      *found = bit;
+      return true;
+    }
+  }
+  return false;
+}
+
+void combine_categorical_runs::deflate_decoder::decode(
+    unsigned long long start_bit, const std::string *window,
+    unsigned long long stop_bit, unsigned long max_output, span *res) {
+  if (!res) throw std::domain_error("deflate_decoder::decode: null pointer");
+  seek(start_bit);
+  start_output(window);
+  std::vector<member_trailer> trailers;
+  bool stream_end = false;
+  status result = status_ok;
+  if (!start_bit) {
+    if ((result = read_member_header()) != status_ok) fail(result);
+    _floor = _size;
+  }
+  while (true) {
+    unsigned long long here = position();
+    if (here > start_bit) {
+      if (here >= stop_bit && (peek(3) & 7) == 4) break;
+      if (output_size() >= max_output) break;
+    }
+    unsigned long is_final = bits(1);
+    unsigned long type = bits(2);
+    if (!type) {
+      result = copy_stored();
+    } else if (type == 1) {
+      result = decode_block(_fixed_literals, _fixed_distances);
+    } else if (type == 2) {
+      result = read_dynamic_header(&_literals, &_distances);
+      if (result == status_ok) result = decode_block(_literals, _distances);
+    } else {
+      result = status_bad;
+    }
+    if (result != status_ok) fail(result);
+    if (!is_final) continue;
+    align();
+    member_trailer trailer;
+    trailer.offset = output_size();
+    trailer.crc = bits(16);
+    trailer.crc |= bits(16) << 16;
+    trailer.size = bits(16);
+    trailer.size |= bits(16) << 16;
+    if (overrun()) fail(status_truncated);
+    trailers.push_back(trailer);
+    // as with gzread, anything after a member other than another member,
+    // such as zero padding, is ignored
+    if (position() + 16 > _file_bits || peek(16) != 0x8b1f) {
+      stream_end = true;
+      break;
+    }
+    if ((result = read_member_header()) != status_ok) fail(result);
+    _floor = _size;
+  }
+  res->valid = true;
+  res->start_bit = start_bit;
+  res->end_bit = position();
+  res->stream_end = stream_end;
+  // copied at their exact size; the decoder keeps its buffers for reuse
+  if (_marking) _marked_count = _size - window_size;
+  if (_marked_count) {
+    res->marked.assign(_marked.begin() + window_size,
+                       _marked.begin() + window_size + _marked_count);
+  } else {
+    res->marked.clear();
+  }
+  if (!_marking) {
+    res->bytes.assign(_bytes, window_size, _size - window_size);
+  } else {
+    res->bytes.clear();
+  }
+  res->trailers.swap(trailers);
+}
+
+void combine_categorical_runs::deflate_decoder::resolve_markers(
+    const span &decoded, const std::string &window, std::string *text) const {
+  if (!text)
+    throw std::domain_error("deflate_decoder::resolve_markers: null pointer");
+  std::string::size_type known =
+      std::min<std::string::size_type>(window.size(), window_size);
+  unsigned long missing = window_size - known;
+  // every value, byte or marker, maps straight to its character
+  std::vector<char> lookup(marker_base + window_size, '\0');
+  for (unsigned i = 0; i < marker_base; ++i) {
+    lookup[i] = static_cast<char>(i);
+  }
+  std::memcpy(&lookup[marker_base + missing],
+              window.data() + window.size() - known, known);
+  text->resize(decoded.marked.size() + decoded.bytes.size());
+  for (std::vector<unsigned short>::size_type i = 0; i < decoded.marked.size();
+       ++i) {
+    (*text)[i] = lookup[decoded.marked[i]];
+  }
+  // markers for output preceding the start of the stream are corrupt
+  if (missing) {
+    for (std::vector<unsigned short>::size_type i = 0;
+         i < decoded.marked.size(); ++i) {
+      if (decoded.marked[i] >= marker_base &&
+          decoded.marked[i] < marker_base + missing)
+        fail(status_bad);
+    }
+  }
+  if (!decoded.bytes.empty())
+    std::memcpy(&(*text)[decoded.marked.size()], decoded.bytes.data(),
+                decoded.bytes.size());
+}
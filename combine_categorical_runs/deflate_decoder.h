@@ -0,0 +1,198 @@
+/*!
+ \file deflate_decoder.h
+ \brief DEFLATE decoding of gzip files from arbitrary block boundaries
+ \copyright Released under the MIT License.
+ Copyright 2021 Cameron Palmer
+
+ Ordinary gzip is a single DEFLATE stream: blocks may copy from up to 32KB
+ of earlier output, and nothing records where blocks begin. To decode parts
+ of one file in parallel, find_block() searches a range of bit offsets for
+ the first position where a dynamic Huffman block header is valid and the
+ block, and the header after it, decode cleanly. decode() can then start
+ there before the preceding output is known: each byte that would be copied
+ from the unknown window is written as a marker naming its window position,
+ and later copies carry markers along. resolve_markers() replaces them once
+ the true preceding 32KB is available. After 32KB of output free of markers,
+ none can appear again, so output switches to plain bytes.
+
+ A speculative start can be a false positive. Callers must confirm that
+ each span begins exactly where the previous span ended, and otherwise
+ decode again from the true position with the window known.
+ */
+
+#ifndef COMBINE_CATEGORICAL_RUNS_DEFLATE_DECODER_H_
+#define COMBINE_CATEGORICAL_RUNS_DEFLATE_DECODER_H_
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace combine_categorical_runs {
+/*!
+  \class deflate_decoder
+  \brief decode spans of a gzip file starting at DEFLATE block boundaries
+ */
+class deflate_decoder {
+ public:
+  static const unsigned window_size = 32768;  //!< DEFLATE history length
+  /*!
+    \brief gzip member trailer encountered while decoding
+   */
+  struct member_trailer {
+    unsigned long offset;  //!< output offset of the end of the member
+    unsigned long crc;     //!< stored CRC-32 of the member
+    unsigned long size;    //!< stored length of the member modulo 2^32
+  };
+  /*!
+    \brief output of decoding from one block boundary to another
+   */
+  struct span {
+    span() : valid(false), start_bit(0), end_bit(0), stream_end(false) {}
+    bool valid;                    //!< whether the span was decoded
+    unsigned long long start_bit;  //!< file bit offset of the first block
+    unsigned long long end_bit;    //!< file bit offset where decoding stopped
+    bool stream_end;               //!< whether the last member ended
+    /*!
+      \brief output decoded while copies from the unknown window were still
+      possible; values below 256 are bytes, and a value v of 256 or more
+      marks byte (v - 256) of the window_size bytes preceding the span
+     */
+    std::vector<unsigned short> marked;
+    std::string bytes;  //!< output following marked
+    std::vector<member_trailer> trailers;  //!< members ending in the span
+  };
+
+  /*!
+    \brief constructor
+    @param filename gzip file to decode
+   */
+  explicit deflate_decoder(const std::string &filename);
+  /*!
+    \brief destructor
+   */
+  ~deflate_decoder() throw() {}
+  /*!
+    \brief report the size of the input
+    \return file size in bits
+   */
+  unsigned long long size_bits() const { return _file_bits; }
+  /*!
+    \brief find the first plausible dynamic block at or after an offset
+    @param from_bit first bit offset to test
+    @param to_bit bit offset at which to stop searching
+    @param found pointer to storage for the bit offset found
+    \return whether a candidate was found
+   */
+  bool find_block(unsigned long long from_bit, unsigned long long to_bit,
+                  unsigned long long *found);
+  /*!
+    \brief decode from a block boundary until a later one
+    @param start_bit bit offset of a block header, or 0 for the start of
+    the file's first gzip member header
+    @param window preceding output, at most window_size bytes, or null if
+    unknown, in which case copies from it are written as markers
+    @param stop_bit decoding stops at the first non-final dynamic block
+    header at or after this offset
+    @param max_output decoding also stops at the first block header of any
+    kind once this much output has been produced
+    @param res pointer to storage for decoded span
+   */
+  void decode(unsigned long long start_bit, const std::string *window,
+              unsigned long long stop_bit, unsigned long max_output,
+              span *res);
+  /*!
+    \brief convert a decoded span to text, replacing markers
+    @param decoded span to convert
+    @param window true output preceding the span, the last window_size
+    bytes if that much exists
+    @param text pointer to storage for span output
+   */
+  void resolve_markers(const span &decoded, const std::string &window,
+                       std::string *text) const;
+
+ private:
+  static const unsigned fast_bits = 10;  //!< bits resolved by table lookup
+  static const unsigned short marker_base = 256;  //!< first marker value
+  /*!
+    \brief outcome of decoding one structure
+   */
+  enum status { status_ok, status_bad, status_truncated, status_switch };
+  /*!
+    \brief canonical Huffman code with a lookup table for short codes
+   */
+  struct huffman {
+    unsigned short count[16];     //!< number of codes of each length
+    unsigned short symbols[288];  //!< symbols ordered by code
+    unsigned short fast[1 << fast_bits];  //!< (symbol << 4) | length, or 0
+  };
+
+  /*!
+    \brief default constructor
+    \warning disabled
+   */
+  deflate_decoder() {
+    throw std::domain_error("deflate_decoder: do not use default constructor");
+  }
+  /*!
+    \brief copy constructor
+    \warning disabled
+   */
+  deflate_decoder(const deflate_decoder &obj) {
+    throw std::domain_error("deflate_decoder: do not use copy constructor");
+  }
+
+  static bool build_huffman(const unsigned char *lengths, unsigned n,
+                            bool code_lengths, huffman *code);
+  void seek(unsigned long long bit);
+  bool fill();
+  void refill();
+  unsigned long long position() const {
+    return (_buffer_offset + _buffer_position + _padding) * 8 - _n_bits;
+  }
+  bool overrun() const { return _padding && position() > _file_bits; }
+  unsigned long bits(unsigned n);
+  unsigned long peek(unsigned n);
+  void align();
+  int decode_symbol(const huffman &code);
+  static int decode_symbol(const huffman &code, unsigned long long *bits,
+                           unsigned *n_bits);
+  status read_dynamic_header(huffman *literals, huffman *distances);
+  status read_member_header();
+  status check_next_header();
+  status decode_block(const huffman &literals, const huffman &distances);
+  template <class buffer_type>
+  status decode_codes(const huffman &literals, const huffman &distances,
+                      buffer_type *out);
+  status copy_stored();
+  void start_output(const std::string *window);
+  void switch_to_bytes();
+  unsigned long output_size() const;
+  void fail(status result) const;
+
+  std::string _filename;                 //!< name of input
+  std::ifstream _input;                  //!< compressed input
+  unsigned long long _file_bits;         //!< input size in bits
+  std::vector<unsigned char> _buffer;    //!< compressed bytes
+  unsigned long long _buffer_offset;     //!< file offset of _buffer[0]
+  unsigned long _buffer_position;        //!< next unread byte of _buffer
+  unsigned long _buffer_end;             //!< valid bytes in _buffer
+  unsigned long _padding;                //!< zero bytes supplied past EOF
+  bool _eof;                             //!< whether the input is exhausted
+  unsigned long long _bits;              //!< bit accumulator
+  unsigned _n_bits;                      //!< valid bits in _bits
+  huffman _fixed_literals;               //!< fixed literal/length code
+  huffman _fixed_distances;              //!< fixed distance code
+  huffman _literals;                     //!< current dynamic literal code
+  huffman _distances;                    //!< current dynamic distance code
+  bool _marking;                         //!< whether output is marked
+  std::vector<unsigned short> _marked;   //!< window then marked output
+  std::string _bytes;                    //!< window then byte output
+  unsigned long _marked_count;           //!< marked output after window
+  unsigned long _size;                   //!< used length of active buffer
+  unsigned long _floor;                  //!< first valid copy source
+  unsigned long _last_marker;            //!< one past the latest marker
+};
+}  // namespace combine_categorical_runs
+
+#endif  // COMBINE_CATEGORICAL_RUNS_DEFLATE_DECODER_H_
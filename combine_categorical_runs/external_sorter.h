@@ -0,0 +1,316 @@
+/*!
+ \file external_sorter.h
+ \brief bounded-memory sort of arbitrary records via sorted runs on disk
+ \copyright Released under the MIT License.
+ Copyright 2021 Cameron Palmer
+
+ Records are buffered in memory until an approximate byte budget is
+ exceeded, at which point the buffer is sorted and written to a run file in
+ scratch space. Once all records have been pushed, runs are merged back
+ together and streamed out in sorted order. If no run was ever spilled, the
+ in-memory buffer is streamed directly.
+
+ record_type must provide operator<, stream insertion/extraction operators
+ that round-trip a single record, and a member function memory_footprint()
+ reporting the heap memory it owns beyond sizeof(record_type), such as
+ string_heap_footprint() of its string members. The budget covers those
+ heap blocks and the full capacity of the record buffer, including the
+ moment the buffer is reallocated; file buffers used while merging runs add
+ roughly 1MB on top.
+ */
+
+#ifndef COMBINE_CATEGORICAL_RUNS_EXTERNAL_SORTER_H_
+#define COMBINE_CATEGORICAL_RUNS_EXTERNAL_SORTER_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace combine_categorical_runs {
+/*!
+  \brief estimate the heap memory owned by a string
+  @param str string to measure
+  \return bytes allocated for the string's contents, including allocator
+  overhead, or 0 if short enough to be stored within the string object
+ */
+inline unsigned long string_heap_footprint(const std::string &str) {
+  std::less<const char *> before;
+  const char *data = str.data();
+  const char *object = reinterpret_cast<const char *>(&str);
+  if (!before(data, object) && before(data, object + sizeof(std::string)))
+    return 0;
+  // malloc adds a header and rounds each request up to 16 bytes
+  return (str.capacity() + 1 + 8 + 15) / 16 * 16;
+}
+
+/*!
+  \class external_sorter
+  \brief sort records with bounded memory by spilling runs to disk
+  @tparam record_type class of record being sorted
+ */
+template <class record_type>
+class external_sorter {
+ public:
+  /*!
+    \brief constructor
+    @param scratch_prefix path prefix for run files; must be writable
+    @param max_bytes approximate number of bytes of records to buffer
+    before spilling a run
+   */
+  external_sorter(const std::string &scratch_prefix, unsigned long max_bytes)
+      : _scratch_prefix(scratch_prefix),
+        _max_bytes(max_bytes),
+        _record_bytes(0),
+        _next_run_index(0),
+        _finalized(false),
+        _buffer_position(0) {}
+  /*!
+    \brief destructor; removes any remaining run files
+   */
+  ~external_sorter() throw() { clear_runs(); }
+
+  /*!
+    \brief add a record to be sorted
+    @param record record to add
+   */
+  void push(const record_type &record) {
+    if (_finalized)
+      throw std::logic_error("external_sorter::push: sorter already finalized");
+    unsigned long record_bytes = record.memory_footprint();
+    if (_buffer.size() == _buffer.capacity()) {
+      // growing the buffer briefly holds both the old and new arrays
+      typename std::vector<record_type>::size_type grown =
+          _buffer.empty() ? _initial_capacity : 2 * _buffer.capacity();
+      if (!_buffer.empty() &&
+          _record_bytes + record_bytes +
+                  (_buffer.capacity() + grown) * sizeof(record_type) >
+              _max_bytes) {
+        spill();
+        grown = _initial_capacity;
+      }
+      _buffer.reserve(grown);
+    }
+    _buffer.push_back(record);
+    _record_bytes += record_bytes;
+    if (memory_usage() >= _max_bytes) spill();
+  }
+
+  /*!
+    \brief write any buffered records to a run on disk, releasing their
+    memory
+
+    Output is then merged from disk even if the records would have fit in
+    memory. This must be called before output begins.
+   */
+  void release_memory() {
+    if (_finalized)
+      throw std::logic_error(
+          "external_sorter::release_memory: sorter already finalized");
+    spill();
+  }
+
+  /*!
+    \brief report approximate memory held by buffered records
+    \return approximate bytes of buffered records and buffer capacity
+   */
+  unsigned long memory_usage() const {
+    return _record_bytes + _buffer.capacity() * sizeof(record_type);
+  }
+
+  /*!
+    \brief complete input and prepare sorted output stream
+
+    If runs were spilled, they are merged down until few enough remain to be
+    held open simultaneously.
+   */
+  void finalize() {
+    if (_finalized) return;
+    _finalized = true;
+    if (_runs.empty()) {
+      std::sort(_buffer.begin(), _buffer.end());
+      _buffer_position = 0;
+      return;
+    }
+    spill();
+    while (_runs.size() > _max_fan_in) {
+      std::vector<std::string> batch(_runs.begin(),
+                                     _runs.begin() + _max_fan_in);
+      std::string merged = next_run_name();
+      merge_runs(batch, merged);
+      _runs.erase(_runs.begin(), _runs.begin() + _max_fan_in);
+      _runs.push_back(merged);
+    }
+    open_merge(_runs);
+  }
+
+  /*!
+    \brief extract the next record in sorted order
+    @param record pointer to storage for extracted record
+    \return whether a record was extracted
+   */
+  bool pop(record_type *record) {
+    if (!record) throw std::domain_error("external_sorter::pop: null pointer");
+    if (!_finalized) finalize();
+    if (_runs.empty()) {
+      if (_buffer_position >= _buffer.size()) {
+        // nothing more will be read from the buffer
+        std::vector<record_type>().swap(_buffer);
+        _buffer_position = 0;
+        _record_bytes = 0;
+        return false;
+      }
+      *record = _buffer.at(_buffer_position++);
+      return true;
+    }
+    return pop_merge(record);
+  }
+
+  /*!
+    \brief report whether any run has been written to disk
+    \return whether any run has been written to disk
+   */
+  bool spilled() const { return !_runs.empty(); }
+
+ private:
+  typedef std::pair<record_type, unsigned> heap_entry;
+  struct heap_compare {
+    bool operator()(const heap_entry &a, const heap_entry &b) const {
+      return b.first < a.first;
+    }
+  };
+  typedef std::priority_queue<heap_entry, std::vector<heap_entry>,
+                              heap_compare>
+      merge_heap;
+
+  /*!
+    \brief default constructor
+    \warning disabled
+   */
+  external_sorter() {
+    throw std::domain_error("external_sorter: do not use default constructor");
+  }
+  /*!
+    \brief copy constructor
+    \warning disabled
+   */
+  external_sorter(const external_sorter &obj) {
+    throw std::domain_error("external_sorter: do not use copy constructor");
+  }
+
+  std::string next_run_name() {
+    std::ostringstream o;
+    o << _scratch_prefix << ".run" << _next_run_index++;
+    return o.str();
+  }
+
+  void spill() {
+    if (_buffer.empty()) return;
+    std::sort(_buffer.begin(), _buffer.end());
+    std::string filename = next_run_name();
+    std::ofstream output(filename.c_str());
+    if (!output.is_open())
+      throw std::runtime_error("external_sorter: cannot write run file \"" +
+                               filename + "\"");
+    for (typename std::vector<record_type>::const_iterator iter =
+             _buffer.begin();
+         iter != _buffer.end(); ++iter) {
+      if (!(output << *iter << '\n'))
+        throw std::runtime_error("external_sorter: write failure to \"" +
+                                 filename + "\"");
+    }
+    output.close();
+    _runs.push_back(filename);
+    std::vector<record_type>().swap(_buffer);
+    _record_bytes = 0;
+  }
+
+  void open_merge(const std::vector<std::string> &filenames) {
+    close_merge();
+    _merge_inputs.resize(filenames.size(), 0);
+    for (unsigned i = 0; i < filenames.size(); ++i) {
+      _merge_inputs.at(i) = new std::ifstream(filenames.at(i).c_str());
+      if (!_merge_inputs.at(i)->is_open())
+        throw std::runtime_error("external_sorter: cannot read run file \"" +
+                                 filenames.at(i) + "\"");
+      refill(i);
+    }
+  }
+
+  void refill(unsigned index) {
+    record_type record;
+    if (*_merge_inputs.at(index) >> record)
+      _heap.push(std::make_pair(record, index));
+  }
+
+  bool pop_merge(record_type *record) {
+    if (_heap.empty()) {
+      close_merge();
+      return false;
+    }
+    *record = _heap.top().first;
+    unsigned index = _heap.top().second;
+    _heap.pop();
+    refill(index);
+    return true;
+  }
+
+  void close_merge() {
+    while (!_heap.empty()) _heap.pop();
+    for (unsigned i = 0; i < _merge_inputs.size(); ++i) {
+      delete _merge_inputs.at(i);
+    }
+    _merge_inputs.clear();
+  }
+
+  void merge_runs(const std::vector<std::string> &filenames,
+                  const std::string &target) {
+    std::ofstream output(target.c_str());
+    if (!output.is_open())
+      throw std::runtime_error("external_sorter: cannot write run file \"" +
+                               target + "\"");
+    open_merge(filenames);
+    record_type record;
+    while (pop_merge(&record)) {
+      if (!(output << record << '\n'))
+        throw std::runtime_error("external_sorter: write failure to \"" +
+                                 target + "\"");
+    }
+    close_merge();
+    output.close();
+    for (unsigned i = 0; i < filenames.size(); ++i) {
+      std::remove(filenames.at(i).c_str());
+    }
+  }
+
+  void clear_runs() {
+    close_merge();
+    for (unsigned i = 0; i < _runs.size(); ++i) {
+      std::remove(_runs.at(i).c_str());
+    }
+    _runs.clear();
+  }
+
+  static const unsigned _max_fan_in = 64;  //!< max runs merged at once
+  static const unsigned _initial_capacity = 16;  //!< first buffer allocation
+  std::string _scratch_prefix;             //!< prefix for run filenames
+  unsigned long _max_bytes;                //!< spill threshold
+  unsigned long _record_bytes;             //!< heap owned by buffered records
+  unsigned _next_run_index;                //!< counter for run filenames
+  bool _finalized;                         //!< whether input is complete
+  std::vector<record_type> _buffer;        //!< unsorted pending records
+  typename std::vector<record_type>::size_type
+      _buffer_position;  //!< output cursor for unspilled buffer
+  std::vector<std::string> _runs;          //!< run files on disk
+  std::vector<std::ifstream *> _merge_inputs;  //!< open run files
+  merge_heap _heap;                        //!< k-way merge frontier
+};
+}  // namespace combine_categorical_runs
+
+#endif  // COMBINE_CATEGORICAL_RUNS_EXTERNAL_SORTER_H_
@@ -0,0 +1,579 @@
+/*!
+  \file line_reader.cc
+  \brief method implementation for line readers
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include "combine_categorical_runs/line_reader.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "finter/finter.h"
+
+namespace {
+const unsigned bgzf_blocks_per_batch = 16;  //!< blocks per worker job
+const unsigned gzip_chunk_size = 1 << 20;   //!< decompressed bytes per chunk
+const unsigned gzip_input_size = 1 << 18;   //!< compressed bytes per read
+const unsigned gzip_span_expansion = 32;    //!< output cap per span byte
+
+unsigned read_le16(const unsigned char *data) {
+  return static_cast<unsigned>(data[0]) | static_cast<unsigned>(data[1]) << 8;
+}
+
+unsigned long read_le32(const unsigned char *data) {
+  return static_cast<unsigned long>(read_le16(data)) |
+         static_cast<unsigned long>(read_le16(data + 2)) << 16;
+}
+
+/*!
+  \brief read the start of a file
+  @param filename name of file
+  @param n number of bytes requested
+  \return up to n bytes from the start of the file
+ */
+std::string read_prefix(const std::string &filename, unsigned n) {
+  std::ifstream input(filename.c_str(), std::ios::binary);
+  if (!input.is_open())
+    throw std::runtime_error("cannot open file \"" + filename + "\"");
+  std::string res(n, '\0');
+  input.read(&res[0], n);
+  res.resize(input.gcount());
+  return res;
+}
+}  // namespace
+
+combine_categorical_runs::finter_line_reader::finter_line_reader(
+    const std::string &filename)
+    : _input(0) {
+  _input = finter::reconcile_reader(filename);
+}
+
+combine_categorical_runs::finter_line_reader::~finter_line_reader() throw() {
+  if (_input) delete _input;
+}
+
+bool combine_categorical_runs::finter_line_reader::getline(std::string *line) {
+  return _input->getline(line);
+}
+
+void combine_categorical_runs::finter_line_reader::close() {
+  if (_input) {
+    _input->close();
+    delete _input;
+    _input = 0;
+  }
+}
+
+combine_categorical_runs::parallel_gzip_reader::parallel_gzip_reader(
+    const std::string &filename, unsigned n_threads, unsigned long split_size)
+    : _filename(filename),
+      _input(filename.c_str(), std::ios::binary),
+      _max_outstanding(4 * (n_threads ? n_threads : 1)),
+      _max_spans((n_threads ? n_threads : 1) + 1),
+      _split_size(split_size),
+      _sequences_issued(0),
+      _next_delivery(0),
+      _n_spans(0),
+      _spans_issued(0),
+      _spans_consumed(0),
+      _reading_done(false),
+      _stopping(false),
+      _chunk_offset(0) {
+  if (!_input.is_open())
+    throw std::runtime_error("parallel_gzip_reader: cannot open file \"" +
+                             filename + "\"");
+  if (!split_size)
+    throw std::domain_error("parallel_gzip_reader: split size must be nonzero");
+  try {
+    if (is_bgzf(filename)) {
+      _reader = std::thread(&parallel_gzip_reader::read_bgzf, this);
+      for (unsigned i = 0; i < (n_threads ? n_threads : 1); ++i) {
+        _workers.push_back(
+            std::thread(&parallel_gzip_reader::decompress_bgzf, this));
+      }
+    } else {
+      _input.seekg(0, std::ios::end);
+      unsigned long long file_size = _input.tellg();
+      _input.seekg(0, std::ios::beg);
+      if (n_threads > 1 && file_size >= 2 * _split_size) {
+        _n_spans = (file_size + _split_size - 1) / _split_size;
+        _reader =
+            std::thread(&parallel_gzip_reader::assemble_gzip_spans, this);
+        for (unsigned i = 0; i < n_threads; ++i) {
+          _workers.push_back(
+              std::thread(&parallel_gzip_reader::decompress_gzip_spans, this));
+        }
+      } else {
+        _reader = std::thread(&parallel_gzip_reader::read_gzip, this);
+      }
+    }
+  } catch (...) {
+    close();
+    throw;
+  }
+}
+
+combine_categorical_runs::parallel_gzip_reader::
+    ~parallel_gzip_reader() throw() {
+  try {
+    close();
+  } catch (...) {
+  }
+}
+
+bool combine_categorical_runs::parallel_gzip_reader::is_gzip(
+    const std::string &filename) {
+  std::string prefix = read_prefix(filename, 2);
+  return prefix.size() == 2 && static_cast<unsigned char>(prefix[0]) == 31 &&
+         static_cast<unsigned char>(prefix[1]) == 139;
+}
+
+bool combine_categorical_runs::parallel_gzip_reader::is_bgzf(
+    const std::string &filename) {
+  std::string prefix = read_prefix(filename, 18);
+  if (prefix.size() < 18) return false;
+  const unsigned char *data =
+      reinterpret_cast<const unsigned char *>(prefix.data());
+  return data[0] == 31 && data[1] == 139 && data[2] == 8 && (data[3] & 4) &&
+         read_le16(data + 10) >= 6 && data[12] == 'B' && data[13] == 'C' &&
+         read_le16(data + 14) == 2;
+}
+
+bool combine_categorical_runs::parallel_gzip_reader::getline(
+    std::string *line) {
+  if (!line)
+    throw std::domain_error("parallel_gzip_reader::getline: null pointer");
+  line->clear();
+  while (true) {
+    if (_chunk_offset < _chunk.size()) {
+      std::string::size_type end = _chunk.find('\n', _chunk_offset);
+      if (end != std::string::npos) {
+        line->append(_chunk, _chunk_offset, end - _chunk_offset);
+        _chunk_offset = end + 1;
+        return true;
+      }
+      line->append(_chunk, _chunk_offset, std::string::npos);
+      _chunk_offset = _chunk.size();
+    }
+    if (!next_chunk()) return !line->empty();
+  }
+}
+
+void combine_categorical_runs::parallel_gzip_reader::close() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _work_available.notify_all();
+  _space_available.notify_all();
+  _result_available.notify_all();
+  _span_available.notify_all();
+  if (_reader.joinable()) _reader.join();
+  for (unsigned i = 0; i < _workers.size(); ++i) {
+    if (_workers.at(i).joinable()) _workers.at(i).join();
+  }
+  _workers.clear();
+  if (_input.is_open()) _input.close();
+}
+
+bool combine_categorical_runs::parallel_gzip_reader::read_bgzf_block(
+    std::string *block) {
+  unsigned char header[12];
+  _input.read(reinterpret_cast<char *>(header), 12);
+  if (!_input.gcount()) return false;
+  if (_input.gcount() != 12 || header[0] != 31 || header[1] != 139 ||
+      header[2] != 8 || !(header[3] & 4))
+    throw std::runtime_error("parallel_gzip_reader: invalid BGZF header in \"" +
+                             _filename + "\"");
+  unsigned xlen = read_le16(header + 10);
+  std::string extra(xlen, '\0');
+  _input.read(&extra[0], xlen);
+  if (static_cast<unsigned>(_input.gcount()) != xlen)
+    throw std::runtime_error(
+        "parallel_gzip_reader: truncated BGZF header in \"" + _filename + "\"");
+  const unsigned char *data =
+      reinterpret_cast<const unsigned char *>(extra.data());
+  unsigned long block_size = 0;
+  for (unsigned offset = 0; offset + 4 <= xlen;
+       offset += 4 + read_le16(data + offset + 2)) {
+    if (data[offset] == 'B' && data[offset + 1] == 'C' &&
+        read_le16(data + offset + 2) == 2 && offset + 6 <= xlen) {
+      block_size = read_le16(data + offset + 4) + 1;
+      break;
+    }
+  }
+  if (block_size < 12 + xlen + 8)
+    throw std::runtime_error(
+        "parallel_gzip_reader: missing BGZF block size in \"" + _filename +
+        "\"");
+  block->assign(reinterpret_cast<const char *>(header), 12);
+  *block += extra;
+  std::string::size_type remaining = block_size - 12 - xlen;
+  std::string::size_type start = block->size();
+  block->resize(block_size);
+  _input.read(&(*block)[start], remaining);
+  if (static_cast<std::string::size_type>(_input.gcount()) != remaining)
+    throw std::runtime_error(
+        "parallel_gzip_reader: truncated BGZF block in \"" + _filename + "\"");
+  return true;
+}
+
+void combine_categorical_runs::parallel_gzip_reader::read_bgzf() {
+  try {
+    while (true) {
+      block_batch batch;
+      std::string block;
+      while (batch.blocks.size() < bgzf_blocks_per_batch &&
+             read_bgzf_block(&block)) {
+        batch.blocks.push_back(block);
+      }
+      if (batch.blocks.empty()) break;
+      std::unique_lock<std::mutex> lock(_mutex);
+      _space_available.wait(lock, [this]() {
+        return _stopping ||
+               _sequences_issued - _next_delivery < _max_outstanding;
+      });
+      if (_stopping) return;
+      batch.sequence = _sequences_issued++;
+      _pending.push_back(batch);
+      lock.unlock();
+      _work_available.notify_one();
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _reading_done = true;
+    }
+    _work_available.notify_all();
+    _result_available.notify_all();
+  } catch (...) {
+    fail(std::current_exception());
+  }
+}
+
+void combine_categorical_runs::parallel_gzip_reader::decompress_bgzf() {
+  try {
+    while (true) {
+      block_batch batch;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _work_available.wait(lock, [this]() {
+          return _stopping || !_pending.empty() || _reading_done;
+        });
+        if (_stopping || _pending.empty()) return;
+        batch = _pending.front();
+        _pending.pop_front();
+      }
+      std::string chunk = "";
+      for (std::vector<std::string>::const_iterator iter =
+               batch.blocks.begin();
+           iter != batch.blocks.end(); ++iter) {
+        const unsigned char *data =
+            reinterpret_cast<const unsigned char *>(iter->data());
+        unsigned header_size = 12 + read_le16(data + 10);
+        unsigned long expected_crc = read_le32(data + iter->size() - 8);
+        unsigned long expected_size = read_le32(data + iter->size() - 4);
+        std::string::size_type start = chunk.size();
+        chunk.resize(start + expected_size);
+        if (expected_size) {
+          z_stream strm;
+          strm.zalloc = Z_NULL;
+          strm.zfree = Z_NULL;
+          strm.opaque = Z_NULL;
+          strm.next_in = const_cast<Bytef *>(data + header_size);
+          strm.avail_in = iter->size() - header_size - 8;
+          if (inflateInit2(&strm, -15) != Z_OK)
+            throw std::runtime_error(
+                "parallel_gzip_reader: cannot initialize zlib");
+          strm.next_out = reinterpret_cast<Bytef *>(&chunk[start]);
+          strm.avail_out = expected_size;
+          int status = inflate(&strm, Z_FINISH);
+          inflateEnd(&strm);
+          if (status != Z_STREAM_END || strm.avail_out)
+            throw std::runtime_error(
+                "parallel_gzip_reader: corrupt BGZF block in \"" + _filename +
+                "\"");
+        }
+        unsigned long crc = crc32(0L, Z_NULL, 0);
+        crc = crc32(crc, reinterpret_cast<const Bytef *>(chunk.data() + start),
+                    expected_size);
+        if (crc != expected_crc)
+          throw std::runtime_error(
+              "parallel_gzip_reader: CRC mismatch in BGZF block in \"" +
+              _filename + "\"");
+      }
+      publish(batch.sequence, &chunk);
+    }
+  } catch (...) {
+    fail(std::current_exception());
+  }
+}
+
+void combine_categorical_runs::parallel_gzip_reader::read_gzip() {
+  z_stream strm;
+  strm.zalloc = Z_NULL;
+  strm.zfree = Z_NULL;
+  strm.opaque = Z_NULL;
+  strm.next_in = Z_NULL;
+  strm.avail_in = 0;
+  // automatic gzip/zlib header detection
+  if (inflateInit2(&strm, 15 + 32) != Z_OK) {
+    fail(std::make_exception_ptr(
+        std::runtime_error("parallel_gzip_reader: cannot initialize zlib")));
+    return;
+  }
+  try {
+    std::string input_buffer(gzip_input_size, '\0');
+    std::string chunk(gzip_chunk_size, '\0');
+    strm.next_out = reinterpret_cast<Bytef *>(&chunk[0]);
+    strm.avail_out = gzip_chunk_size;
+    bool input_exhausted = false, member_open = true;
+    // read more compressed input, keeping any unconsumed bytes
+    auto refill = [&]() {
+      unsigned kept = strm.avail_in;
+      if (kept) std::memmove(&input_buffer[0], strm.next_in, kept);
+      _input.read(&input_buffer[kept], gzip_input_size - kept);
+      strm.next_in = reinterpret_cast<Bytef *>(&input_buffer[0]);
+      strm.avail_in = kept + _input.gcount();
+      if (!_input.gcount()) input_exhausted = true;
+    };
+    while (member_open) {
+      if (!strm.avail_in && !input_exhausted) refill();
+      // inflate may still hold output after consuming all input
+      int status = inflate(&strm, Z_NO_FLUSH);
+      if (status == Z_BUF_ERROR && !strm.avail_in && input_exhausted)
+        throw std::runtime_error(
+            "parallel_gzip_reader: truncated gzip data in \"" + _filename +
+            "\"");
+      if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+        throw std::runtime_error(
+            "parallel_gzip_reader: corrupt gzip data in \"" + _filename +
+            "\"");
+      if (status == Z_STREAM_END) {
+        // concatenated gzip members continue the same stream. as with
+        // gzread, anything else after a complete member, such as zero
+        // padding, is ignored
+        if (strm.avail_in < 2 && !input_exhausted) refill();
+        member_open = strm.avail_in >= 2 && strm.next_in[0] == 31 &&
+                      strm.next_in[1] == 139;
+        if (member_open && inflateReset(&strm) != Z_OK)
+          throw std::runtime_error("parallel_gzip_reader: cannot reset zlib");
+      }
+      if (!strm.avail_out ||
+          (!member_open && strm.avail_out != gzip_chunk_size)) {
+        chunk.resize(gzip_chunk_size - strm.avail_out);
+        if (!enqueue(&chunk)) {
+          inflateEnd(&strm);
+          return;
+        }
+        chunk.assign(gzip_chunk_size, '\0');
+        strm.next_out = reinterpret_cast<Bytef *>(&chunk[0]);
+        strm.avail_out = gzip_chunk_size;
+      }
+    }
+    inflateEnd(&strm);
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _reading_done = true;
+    }
+    _result_available.notify_all();
+  } catch (...) {
+    inflateEnd(&strm);
+    fail(std::current_exception());
+  }
+}
+
+void combine_categorical_runs::parallel_gzip_reader::decompress_gzip_spans() {
+  try {
+    deflate_decoder decoder(_filename);
+    const unsigned long long split_bits = 8ull * _split_size;
+    const std::string empty = "";
+    while (true) {
+      unsigned long index = 0;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _space_available.wait(lock, [this]() {
+          return _stopping || _spans_issued >= _n_spans ||
+                 _spans_issued < _spans_consumed + _max_spans;
+        });
+        // spans the assembler has already passed are not worth decoding
+        _spans_issued = std::max(_spans_issued, _spans_consumed);
+        if (_stopping || _spans_issued >= _n_spans) return;
+        index = _spans_issued++;
+      }
+      deflate_decoder::span decoded;
+      unsigned long long start_bit = 0;
+      try {
+        if (!index) {
+          decoder.decode(0, &empty, split_bits,
+                         gzip_span_expansion * _split_size, &decoded);
+        } else if (decoder.find_block(index * split_bits,
+                                      (index + 1) * split_bits, &start_bit)) {
+          decoder.decode(start_bit, 0, (index + 1) * split_bits,
+                         gzip_span_expansion * _split_size, &decoded);
+        }
+      } catch (const std::runtime_error &) {
+        // a false positive can fail anywhere; the assembler decodes again
+        // from the true position and reports any real error
+        decoded = deflate_decoder::span();
+      }
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (index >= _spans_consumed) _spans[index] = std::move(decoded);
+      }
+      _span_available.notify_all();
+    }
+  } catch (...) {
+    fail(std::current_exception());
+  }
+}
+
+void combine_categorical_runs::parallel_gzip_reader::assemble_gzip_spans() {
+  try {
+    deflate_decoder decoder(_filename);
+    const unsigned long long split_bits = 8ull * _split_size;
+    unsigned long long position = 0;
+    std::string window = "", text = "";
+    unsigned long member_crc = crc32(0L, Z_NULL, 0), member_size = 0;
+    bool stream_end = false;
+    while (!stream_end) {
+      unsigned long index = position / split_bits;
+      deflate_decoder::span decoded;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (index >= _spans_consumed) {
+          // release workers from spans that the last one ran past
+          _spans_consumed = index;
+          _spans.erase(_spans.begin(), _spans.lower_bound(index));
+          _space_available.notify_all();
+          _span_available.wait(lock, [this, index]() {
+            return _stopping || _spans.count(index);
+          });
+          if (_stopping) return;
+          decoded = std::move(_spans[index]);
+          _spans.erase(index);
+          _spans_consumed = index + 1;
+        }
+      }
+      _space_available.notify_all();
+      if (!decoded.valid || decoded.start_bit != position) {
+        decoder.decode(position, &window, (index + 1) * split_bits,
+                       gzip_span_expansion * _split_size, &decoded);
+      }
+      decoder.resolve_markers(decoded, window, &text);
+      // check each member's CRC and length as its trailer is reached
+      unsigned long offset = 0;
+      for (std::vector<deflate_decoder::member_trailer>::const_iterator iter =
+               decoded.trailers.begin();
+           iter != decoded.trailers.end(); ++iter) {
+        member_crc =
+            crc32(member_crc,
+                  reinterpret_cast<const Bytef *>(text.data() + offset),
+                  iter->offset - offset);
+        member_size += iter->offset - offset;
+        if (member_crc != iter->crc || (member_size & 0xffffffff) != iter->size)
+          throw std::runtime_error(
+              "parallel_gzip_reader: corrupt gzip data in \"" + _filename +
+              "\"");
+        member_crc = crc32(0L, Z_NULL, 0);
+        member_size = 0;
+        offset = iter->offset;
+      }
+      member_crc =
+          crc32(member_crc,
+                reinterpret_cast<const Bytef *>(text.data() + offset),
+                text.size() - offset);
+      member_size += text.size() - offset;
+      if (text.size() >= deflate_decoder::window_size) {
+        window.assign(text, text.size() - deflate_decoder::window_size,
+                      deflate_decoder::window_size);
+      } else {
+        window += text;
+        if (window.size() > deflate_decoder::window_size)
+          window.erase(0, window.size() - deflate_decoder::window_size);
+      }
+      for (std::string::size_type i = 0; i < text.size();
+           i += gzip_chunk_size) {
+        std::string chunk = text.substr(i, gzip_chunk_size);
+        if (!enqueue(&chunk)) return;
+      }
+      position = decoded.end_bit;
+      stream_end = decoded.stream_end;
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _reading_done = true;
+      _spans_consumed = _n_spans;
+    }
+    _space_available.notify_all();
+    _result_available.notify_all();
+  } catch (...) {
+    fail(std::current_exception());
+  }
+}
+
+bool combine_categorical_runs::parallel_gzip_reader::enqueue(
+    std::string *chunk) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _space_available.wait(lock, [this]() {
+    return _stopping || _sequences_issued - _next_delivery < _max_outstanding;
+  });
+  if (_stopping) return false;
+  _ready[_sequences_issued++].swap(*chunk);
+  lock.unlock();
+  _result_available.notify_all();
+  return true;
+}
+
+void combine_categorical_runs::parallel_gzip_reader::publish(
+    unsigned long sequence, std::string *chunk) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _ready[sequence].swap(*chunk);
+  }
+  _result_available.notify_all();
+}
+
+bool combine_categorical_runs::parallel_gzip_reader::next_chunk() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _result_available.wait(lock, [this]() {
+    return _error || _ready.count(_next_delivery) ||
+           (_reading_done && _next_delivery == _sequences_issued) || _stopping;
+  });
+  if (_error) std::rethrow_exception(_error);
+  std::map<unsigned long, std::string>::iterator finder =
+      _ready.find(_next_delivery);
+  if (finder == _ready.end()) return false;
+  _chunk.swap(finder->second);
+  _chunk_offset = 0;
+  _ready.erase(finder);
+  ++_next_delivery;
+  lock.unlock();
+  _space_available.notify_all();
+  return true;
+}
+
+void combine_categorical_runs::parallel_gzip_reader::fail(
+    std::exception_ptr error) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_error) _error = error;
+    _stopping = true;
+  }
+  _work_available.notify_all();
+  _space_available.notify_all();
+  _result_available.notify_all();
+  _span_available.notify_all();
+}
+
+combine_categorical_runs::line_reader *
+combine_categorical_runs::open_line_reader(const std::string &filename,
+                                           unsigned decompression_threads) {
+  if (decompression_threads > 1 && parallel_gzip_reader::is_gzip(filename))
+    return new parallel_gzip_reader(filename, decompression_threads);
+  return new finter_line_reader(filename);
+}
@@ -0,0 +1,202 @@
+/*!
+ \file line_reader.h
+ \brief line-oriented input with optional multithreaded gzip decompression
+ \copyright Released under the MIT License.
+ Copyright 2021 Cameron Palmer
+ */
+
+#ifndef COMBINE_CATEGORICAL_RUNS_LINE_READER_H_
+#define COMBINE_CATEGORICAL_RUNS_LINE_READER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "combine_categorical_runs/deflate_decoder.h"
+
+// installed headers only need finter types by pointer
+namespace finter {
+class finter_reader;
+}  // namespace finter
+
+namespace combine_categorical_runs {
+/*!
+  \class line_reader
+  \brief interface for reading an input file one line at a time
+ */
+class line_reader {
+ public:
+  /*!
+    \brief destructor
+   */
+  virtual ~line_reader() throw() {}
+  /*!
+    \brief read the next line
+    @param line pointer to storage for line, without trailing newline
+    \return whether a line was read
+   */
+  virtual bool getline(std::string *line) = 0;
+  /*!
+    \brief release the underlying file
+   */
+  virtual void close() = 0;
+};
+
+/*!
+  \class finter_line_reader
+  \brief line reader backed by finter, supporting plaintext, gzip and bzip2
+ */
+class finter_line_reader : public line_reader {
+ public:
+  /*!
+    \brief constructor
+    @param filename name of file to open
+   */
+  explicit finter_line_reader(const std::string &filename);
+  /*!
+    \brief destructor
+   */
+  ~finter_line_reader() throw();
+  bool getline(std::string *line);
+  void close();
+
+ private:
+  finter::finter_reader *_input;  //!< underlying reader
+};
+
+/*!
+  \class parallel_gzip_reader
+  \brief line reader that decompresses gzip input off the calling thread
+
+  BGZF input, as written by bgzip, is a series of independent gzip members
+  with their compressed size in the header; these are inflated by a pool of
+  worker threads and delivered in order.
+
+  Ordinary gzip records no block boundaries, so it is split speculatively:
+  each worker takes a fixed range of compressed input, searches it for the
+  first plausible DEFLATE block header, and decodes from there, writing
+  copies from the unknown preceding 32KB as markers (see deflate_decoder).
+  A single assembler thread walks the spans in order, propagating the true
+  window into each span's markers. A span is only used if it starts exactly
+  where the previous one ended; a false positive, or a span a worker could
+  not decode, is decoded again by the assembler from the true position, so
+  output and errors match serial decoding. Member CRCs are checked as spans
+  are assembled. Small files, and single-threaded reads, are inflated by
+  one background thread with zlib.
+
+  Trailing data after the last complete gzip member, such as zero padding,
+  is ignored, as by gzread.
+ */
+class parallel_gzip_reader : public line_reader {
+ public:
+  /*!
+    \brief constructor
+    @param filename name of gzip or BGZF file to open
+    @param n_threads number of decompression threads
+    @param split_size compressed bytes per speculatively decoded span of
+    ordinary gzip input
+   */
+  parallel_gzip_reader(const std::string &filename, unsigned n_threads,
+                       unsigned long split_size = default_split_size);
+  /*!
+    \brief destructor; stops background threads
+   */
+  ~parallel_gzip_reader() throw();
+  bool getline(std::string *line);
+  void close();
+  /*!
+    \brief determine whether a file begins with a BGZF block header
+    @param filename name of file to test
+    \return whether the file is BGZF
+   */
+  static bool is_bgzf(const std::string &filename);
+  /*!
+    \brief determine whether a file begins with the gzip magic number
+    @param filename name of file to test
+    \return whether the file is gzip, including BGZF
+   */
+  static bool is_gzip(const std::string &filename);
+  //! default compressed bytes per span of ordinary gzip input
+  static const unsigned long default_split_size = 1ul << 20;
+
+ private:
+  /*!
+    \brief default constructor
+    \warning disabled
+   */
+  parallel_gzip_reader() {
+    throw std::domain_error(
+        "parallel_gzip_reader: do not use default constructor");
+  }
+  /*!
+    \brief copy constructor
+    \warning disabled
+   */
+  parallel_gzip_reader(const parallel_gzip_reader &obj) {
+    throw std::domain_error(
+        "parallel_gzip_reader: do not use copy constructor");
+  }
+  /*!
+    \brief a batch of compressed BGZF blocks awaiting decompression
+   */
+  struct block_batch {
+    unsigned long sequence;           //!< delivery order
+    std::vector<std::string> blocks;  //!< complete compressed blocks
+  };
+  bool read_bgzf_block(std::string *block);
+  void read_bgzf();
+  void read_gzip();
+  void assemble_gzip_spans();
+  void decompress_bgzf();
+  void decompress_gzip_spans();
+  bool enqueue(std::string *chunk);
+  void publish(unsigned long sequence, std::string *chunk);
+  bool next_chunk();
+  void fail(std::exception_ptr error);
+
+  std::string _filename;            //!< name of input, for error messages
+  std::ifstream _input;             //!< compressed input
+  unsigned _max_outstanding;        //!< batches held before reader waits
+  unsigned _max_spans;              //!< gzip spans decoded ahead of use
+  unsigned long _split_size;        //!< compressed bytes per gzip span
+  std::mutex _mutex;                //!< guards all state below
+  std::condition_variable _work_available;    //!< batches queued or stopping
+  std::condition_variable _result_available;  //!< chunk ready or failure
+  std::condition_variable _space_available;   //!< consumer took a chunk
+  std::condition_variable _span_available;    //!< speculative span decoded
+  std::deque<block_batch> _pending;  //!< batches awaiting decompression
+  std::map<unsigned long, std::string> _ready;  //!< decompressed chunks
+  unsigned long _sequences_issued;    //!< batches read so far
+  unsigned long _next_delivery;       //!< next chunk for consumer
+  std::map<unsigned long, deflate_decoder::span> _spans;  //!< decoded spans
+  unsigned long _n_spans;             //!< gzip spans in the input
+  unsigned long _spans_issued;        //!< gzip spans taken by workers
+  unsigned long _spans_consumed;      //!< gzip spans taken by assembler
+  bool _reading_done;                 //!< whether input has been fully read
+  bool _stopping;                     //!< whether threads should exit
+  std::exception_ptr _error;          //!< first background failure
+  std::thread _reader;                //!< compressed input thread
+  std::vector<std::thread> _workers;  //!< decompression threads
+  std::string _chunk;                 //!< chunk being split into lines
+  std::string::size_type _chunk_offset;  //!< start of next line in chunk
+};
+
+/*!
+  \brief open a line reader appropriate for a file
+  @param filename name of file to open
+  @param decompression_threads requested decompression threads; gzip input
+  is decompressed by parallel_gzip_reader when this exceeds 1
+  \return newly allocated reader; caller takes ownership
+ */
+line_reader *open_line_reader(const std::string &filename,
+                              unsigned decompression_threads);
+}  // namespace combine_categorical_runs
+
+#endif  // COMBINE_CATEGORICAL_RUNS_LINE_READER_H_
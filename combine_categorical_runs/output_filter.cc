@@ -0,0 +1,92 @@
+/*!
+  \file output_filter.cc
+  \brief method implementation for output row filtering
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include "combine_categorical_runs/output_filter.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "finter/finter.h"
+
+bool combine_categorical_runs::output_filter::admit(const std::string &chr,
+                                                    double min_p,
+                                                    double consensus_p) {
+  ++_counts[chr].first;
+  ++_row_index;
+  if (consensus_p > _max_consensus_p || min_p > _max_min_p) return false;
+  if (_top_k && _heap.size() >= _top_k &&
+      !(consensus_p < _heap.top().consensus_p))
+    return false;
+  _pending = true;
+  _pending_p = consensus_p;
+  _pending_chr = chr;
+  return true;
+}
+
+void combine_categorical_runs::output_filter::emit(const std::string &line) {
+  if (!_pending)
+    throw std::logic_error("output_filter::emit: row was not admitted");
+  _pending = false;
+  if (!_top_k) {
+    ++_counts[_pending_chr].second;
+    _output->writeline(line);
+    return;
+  }
+  held_row row;
+  row.consensus_p = _pending_p;
+  row.row_index = _row_index;
+  row.chr = _pending_chr;
+  row.line = line;
+  _heap.push(row);
+  if (_heap.size() > _top_k) _heap.pop();
+}
+
+void combine_categorical_runs::output_filter::flush() {
+  if (!_top_k) return;
+  std::vector<held_row> rows;
+  rows.reserve(_heap.size());
+  while (!_heap.empty()) {
+    rows.push_back(_heap.top());
+    _heap.pop();
+  }
+  // restore input order
+  std::vector<std::pair<unsigned long, unsigned> > order;
+  for (unsigned i = 0; i < rows.size(); ++i) {
+    order.push_back(std::make_pair(rows.at(i).row_index, i));
+  }
+  std::sort(order.begin(), order.end());
+  for (unsigned i = 0; i < order.size(); ++i) {
+    const held_row &row = rows.at(order.at(i).second);
+    ++_counts[row.chr].second;
+    _output->writeline(row.line);
+  }
+}
+
+void combine_categorical_runs::output_filter::write_report(
+    const std::string &filename) const {
+  finter::finter_writer *output = 0;
+  try {
+    output = finter::reconcile_writer(filename);
+    output->writeline("CHR\tN_TOTAL\tN_REPORTED\tN_FILTERED");
+    for (std::map<std::string,
+                  std::pair<unsigned long, unsigned long> >::const_iterator
+             iter = _counts.begin();
+         iter != _counts.end(); ++iter) {
+      std::ostringstream o;
+      o << iter->first << '\t' << iter->second.first << '\t'
+        << iter->second.second << '\t'
+        << (iter->second.first - iter->second.second);
+      output->writeline(o.str());
+    }
+    output->close();
+    delete output;
+    output = 0;
+  } catch (...) {
+    if (output) delete output;
+    throw;
+  }
+}
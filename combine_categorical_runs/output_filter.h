@@ -0,0 +1,134 @@
+/*!
+ \file output_filter.h
+ \brief significance filtering and top-K selection of combined output rows
+ \copyright Released under the MIT License.
+ Copyright 2021 Cameron Palmer
+ */
+
+#ifndef COMBINE_CATEGORICAL_RUNS_OUTPUT_FILTER_H_
+#define COMBINE_CATEGORICAL_RUNS_OUTPUT_FILTER_H_
+
+#include <map>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// installed headers only need finter types by pointer
+namespace finter {
+class finter_writer;
+}  // namespace finter
+
+namespace combine_categorical_runs {
+/*!
+  \brief user-configurable criteria for reporting combined rows
+
+  The defaults report every row.
+ */
+struct output_filter_settings {
+  output_filter_settings()
+      : max_consensus_p(1.0), max_min_p(1.0), top_k(0), report_filename("") {}
+  /*!
+    \brief report whether any row can be withheld from output
+    \return whether a threshold or top-K limit is set
+   */
+  bool active() const {
+    return max_consensus_p < 1.0 || max_min_p < 1.0 || top_k;
+  }
+  double max_consensus_p;       //!< largest consensus p-value to report
+  double max_min_p;             //!< largest minimum p-value to report
+  unsigned long top_k;          //!< rows to report by consensus p, or 0
+  std::string report_filename;  //!< per-chromosome count report, or ""
+};
+
+/*!
+  \class output_filter
+  \brief decide which combined rows are written, before they are formatted
+
+  For each candidate row, call admit() with the row's p-values; only if it
+  returns true, format the row and pass it to emit(). When top-K mode is
+  active, emitted rows are held in a bounded heap and written in input order
+  by flush(). All rows are tallied by chromosome for an optional report.
+ */
+class output_filter {
+ public:
+  /*!
+    \brief constructor
+    @param output destination for retained rows; not owned
+    @param settings reporting thresholds and top-K count
+   */
+  output_filter(finter::finter_writer *output,
+                const output_filter_settings &settings)
+      : _output(output),
+        _max_consensus_p(settings.max_consensus_p),
+        _max_min_p(settings.max_min_p),
+        _top_k(settings.top_k),
+        _row_index(0),
+        _pending(false),
+        _pending_p(0.0) {
+    if (!_output) throw std::domain_error("output_filter: null pointer");
+  }
+  /*!
+    \brief destructor
+   */
+  ~output_filter() throw() {}
+  /*!
+    \brief test whether a row should be formatted and emitted
+    @param chr chromosome of the row, for reporting
+    @param min_p smallest per-comparison p-value of the row
+    @param consensus_p consensus p-value of the row
+    \return whether the caller should format the row and call emit()
+   */
+  bool admit(const std::string &chr, double min_p, double consensus_p);
+  /*!
+    \brief write or hold a row previously admitted
+    @param line formatted row
+   */
+  void emit(const std::string &line);
+  /*!
+    \brief write any rows held for top-K selection
+   */
+  void flush();
+  /*!
+    \brief write per-chromosome counts of reported and filtered rows
+    @param filename name of report file
+   */
+  void write_report(const std::string &filename) const;
+
+ private:
+  /*!
+    \brief row held in the top-K heap
+   */
+  struct held_row {
+    double consensus_p;       //!< selection key
+    unsigned long row_index;  //!< position in unfiltered output
+    std::string chr;          //!< chromosome for reporting
+    std::string line;         //!< formatted row
+    bool operator<(const held_row &obj) const {
+      if (consensus_p != obj.consensus_p) return consensus_p < obj.consensus_p;
+      return row_index < obj.row_index;
+    }
+  };
+  /*!
+    \brief default constructor
+    \warning disabled
+   */
+  output_filter() {
+    throw std::domain_error("output_filter: do not use default constructor");
+  }
+  finter::finter_writer *_output;  //!< destination for retained rows
+  double _max_consensus_p;         //!< consensus p-value threshold
+  double _max_min_p;               //!< minimum p-value threshold
+  unsigned long _top_k;            //!< maximum rows reported, or 0
+  unsigned long _row_index;        //!< number of rows considered
+  bool _pending;                   //!< whether admit() awaits emit()
+  double _pending_p;               //!< consensus p of pending row
+  std::string _pending_chr;        //!< chromosome of pending row
+  std::priority_queue<held_row> _heap;  //!< worst held row on top
+  std::map<std::string, std::pair<unsigned long, unsigned long> >
+      _counts;  //!< per-chromosome total and reported rows
+};
+}  // namespace combine_categorical_runs
+
+#endif  // COMBINE_CATEGORICAL_RUNS_OUTPUT_FILTER_H_
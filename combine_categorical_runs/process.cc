@@ -0,0 +1,379 @@
+/*!
+  \file process.cc
+  \brief implementation of file-based driver functions
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include "combine_categorical_runs/process.h"
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#include "combine_categorical_runs/line_reader.h"
+#include "combine_categorical_runs/utilities.h"
+#include "finter/finter.h"
+
+void combine_categorical_runs::process_data(
+    const std::vector<std::string> &input_filenames,
+    const std::string &output_filename, consensus_filter *consensus,
+    const combinatorial_counts &combinatorial_file_counts,
+    bool report_datasets, const output_filter_settings &filter_settings,
+    unsigned decompression_threads) {
+  if (input_filenames.size() < 2)
+    throw std::domain_error("process_data: expected at least two input files");
+  if (!consensus) throw std::domain_error("process_data: null pointer");
+  std::vector<line_reader *> inputs;
+  std::vector<unsigned> comparison_numbers;
+  std::string line = "";
+  inputs.resize(input_filenames.size(), 0);
+  comparison_numbers.resize(input_filenames.size(), 0);
+  finter::finter_writer *output = 0;
+  output_filter *filter = 0;
+  try {
+    for (unsigned i = 0; i < input_filenames.size(); ++i) {
+      comparison_numbers.at(i) = get_comparison_number(input_filenames.at(i));
+    }
+    for (unsigned i = 0; i < input_filenames.size(); ++i) {
+      inputs.at(i) =
+          open_line_reader(input_filenames.at(i), decompression_threads);
+    }
+    output = finter::reconcile_writer(output_filename);
+    filter = new output_filter(output, filter_settings);
+    for (unsigned i = 0; i < input_filenames.size(); ++i) {
+      inputs.at(i)->getline(&line);
+    }
+    output->writeline(format_combined_header(
+        comparison_numbers, report_datasets, filter_settings.active()));
+    // pull one line at a time from each file as the combiner needs it;
+    // the combiner parses statistics only for consensus rows
+    std::vector<combiner::line_source> sources;
+    for (unsigned i = 0; i < inputs.size(); ++i) {
+      line_reader *input = inputs.at(i);
+      sources.push_back([input](std::string *data_line) {
+        return input->getline(data_line);
+      });
+    }
+    // rows failing the reporting criteria are never formatted
+    combiner engine(
+        comparison_numbers, combinatorial_file_counts,
+        [filter, report_datasets](const combined_record &record) {
+          filter->emit(format_combined_record(record, report_datasets));
+        },
+        consensus);
+    engine.set_source_names(input_filenames);
+    engine.set_predicate([filter](const combined_record &record) {
+      return filter->admit(record.annotation.at(0), record.min_p,
+                           record.consensus_p);
+    });
+    engine.pull_lines(sources);
+    for (unsigned i = 0; i < inputs.size(); ++i) {
+      inputs.at(i)->close();
+      delete inputs.at(i);
+      inputs.at(i) = 0;
+    }
+    filter->flush();
+    output->close();
+    delete output;
+    output = 0;
+    if (!filter_settings.report_filename.empty())
+      filter->write_report(filter_settings.report_filename);
+    delete filter;
+    filter = 0;
+  } catch (...) {
+    for (std::vector<line_reader *>::iterator iter = inputs.begin();
+         iter != inputs.end(); ++iter) {
+      if (*iter) delete *iter;
+    }
+    if (filter) delete filter;
+    if (output) delete output;
+    throw;
+  }
+}
+
+void combine_categorical_runs::process_incremental(
+    const std::string &combined_filename, const std::string &input_filename,
+    const std::string &output_filename, consensus_filter *consensus,
+    const combinatorial_counts &combinatorial_file_counts,
+    const output_filter_settings &filter_settings,
+    unsigned decompression_threads) {
+  if (!consensus) throw std::domain_error("process_incremental: null pointer");
+  line_reader *combined = 0, *input = 0;
+  finter::finter_writer *output = 0;
+  output_filter *filter = 0;
+  std::string combined_line = "", input_line = "", combined_id = "",
+              input_id = "", token = "";
+  std::vector<std::string> combined_tokens;
+  comparison_record input_record;
+  unsigned comparison_number = get_comparison_number(input_filename);
+  try {
+    combined = open_line_reader(combined_filename, decompression_threads);
+    input = open_line_reader(input_filename, decompression_threads);
+    output = finter::reconcile_writer(output_filename);
+    filter = new output_filter(output, filter_settings);
+    // the existing header names the comparisons already present
+    combined->getline(&combined_line);
+    input->getline(&input_line);
+    std::istringstream strm_header(combined_line);
+    while (strm_header >> token) combined_tokens.push_back(token);
+    std::vector<unsigned> comparison_numbers;
+    while (6 + comparison_numbers.size() < combined_tokens.size() &&
+           !combined_tokens.at(6 + comparison_numbers.size())
+                .compare(0, 9, "BETA_COMP")) {
+      comparison_numbers.push_back(from_string<unsigned>(
+          combined_tokens.at(6 + comparison_numbers.size()).substr(9)));
+    }
+    unsigned n_comparisons = comparison_numbers.size();
+    bool expected_header = n_comparisons &&
+                           combined_tokens.size() == 6 + 2 * n_comparisons + 3;
+    for (unsigned i = 0; expected_header && i < n_comparisons; ++i) {
+      if (combined_tokens.at(6 + n_comparisons + i)
+              .compare("P_COMP" + to_string<unsigned>(
+                                      comparison_numbers.at(i))))
+        expected_header = false;
+    }
+    if (expected_header && !combined_tokens.at(combined_tokens.size() - 1)
+                                .compare("FILTERED_DATASETS"))
+      throw std::domain_error(
+          "process_incremental: existing output \"" + combined_filename +
+          "\" was written with significance or top-K filters; only complete "
+          "output can be extended");
+    if (!expected_header ||
+        combined_tokens.at(combined_tokens.size() - 1).compare("DATASETS"))
+      throw std::domain_error(
+          "process_incremental: existing output \"" + combined_filename +
+          "\" does not have the expected header; it must have been written "
+          "with --report-datasets");
+    // comparisons are kept in increasing order, so each is counted once
+    for (unsigned i = 0; i < n_comparisons; ++i) {
+      if (comparison_numbers.at(i) == comparison_number)
+        throw std::domain_error(
+            "process_incremental: comparison " +
+            to_string<unsigned>(comparison_number) + " is already present in "
+            "existing output \"" + combined_filename + "\"");
+    }
+    if (comparison_number < comparison_numbers.back())
+      throw std::domain_error(
+          "process_incremental: comparison " +
+          to_string<unsigned>(comparison_number) +
+          " must be numbered after the comparisons in existing output \"" +
+          combined_filename + "\"");
+    comparison_numbers.push_back(comparison_number);
+    output->writeline(format_combined_header(comparison_numbers, true,
+                                             filter_settings.active()));
+    combined_line = input_line = "";
+    while (true) {
+      // advance each stream to its next consensus variant
+      while (combined_line.empty() && combined->getline(&combined_line)) {
+        parse_variant_id(combined_line, combined_filename, &combined_id);
+        if (!consensus->retain(0, combined_id)) combined_line = "";
+      }
+      // statistics are only parsed for rows that will be used
+      while (input_line.empty() && input->getline(&input_line)) {
+        parse_variant_id(input_line, input_filename, &input_id);
+        if (!consensus->retain(1, input_id)) {
+          input_line = "";
+        } else {
+          parse_comparison_record(input_line, input_filename, &input_record);
+        }
+      }
+      // rows are only reported when present in both streams
+      if (combined_line.empty() || input_line.empty()) break;
+      // as with process_data, inputs are assumed to share variant order;
+      // on a mismatch, the later input's variant is skipped
+      if (combined_id.compare(input_record.variant_id)) {
+        input_line = "";
+        continue;
+      }
+      combined_tokens.clear();
+      std::istringstream strm2(combined_line);
+      while (strm2 >> token) combined_tokens.push_back(token);
+      if (combined_tokens.size() != 6 + 2 * n_comparisons + 3)
+        throw std::domain_error("insufficient entries for file \"" +
+                                combined_filename + "\" line \"" +
+                                combined_line + "\"");
+      double min_p = input_record.pvalue;
+      for (unsigned i = 0; i < n_comparisons; ++i) {
+        double pvalue =
+            from_string<double>(combined_tokens.at(6 + n_comparisons + i));
+        if (pvalue < min_p) min_p = pvalue;
+      }
+      double consensus_p = compute_consensus_p(min_p, n_comparisons + 1);
+      if (!filter->admit(combined_tokens.at(0), min_p, consensus_p)) {
+        combined_line = input_line = "";
+        continue;
+      }
+      // as in format_combined_record, statistics keep every digit so the
+      // output can be extended again
+      std::ostringstream o;
+      o.precision(std::numeric_limits<double>::max_digits10);
+      for (unsigned i = 0; i < 6; ++i) {
+        o << (i ? "\t" : "") << combined_tokens.at(i);
+      }
+      for (unsigned i = 0; i < n_comparisons; ++i) {
+        o << '\t' << combined_tokens.at(6 + i);
+      }
+      o << '\t' << input_record.beta;
+      for (unsigned i = 0; i < n_comparisons; ++i) {
+        o << '\t' << combined_tokens.at(6 + n_comparisons + i);
+      }
+      o << '\t' << input_record.pvalue;
+      o << '\t' << consensus_p;
+      // resume sample size tracking from the datasets already counted
+      unsigned unique_sample_size =
+          from_string<unsigned>(combined_tokens.at(6 + 2 * n_comparisons + 1));
+      std::map<std::string, bool> tracked_datasets;
+      std::istringstream strm3(combined_tokens.at(6 + 2 * n_comparisons + 2));
+      while (std::getline(strm3, token, ',')) {
+        if (!token.empty()) tracked_datasets[token] = true;
+      }
+      add_unique_sample_size(comparison_number, input_record.n,
+                             combinatorial_file_counts, &tracked_datasets,
+                             &unique_sample_size);
+      o << '\t' << unique_sample_size << '\t'
+        << format_tracked_datasets(tracked_datasets);
+      filter->emit(o.str());
+      combined_line = input_line = "";
+    }
+    combined->close();
+    delete combined;
+    combined = 0;
+    input->close();
+    delete input;
+    input = 0;
+    filter->flush();
+    output->close();
+    delete output;
+    output = 0;
+    if (!filter_settings.report_filename.empty())
+      filter->write_report(filter_settings.report_filename);
+    delete filter;
+    filter = 0;
+  } catch (...) {
+    if (combined) delete combined;
+    if (input) delete input;
+    if (filter) delete filter;
+    if (output) delete output;
+    throw;
+  }
+}
+
+void combine_categorical_runs::find_consensus_variants(
+    const std::string &filename, std::map<std::string, unsigned> *target,
+    unsigned decompression_threads) {
+  if (!target) throw std::domain_error("find_consensus_variants: null pointer");
+  scan_variant_ids(
+      filename, [target](const std::string &id) { ++(*target)[id]; },
+      decompression_threads);
+}
+
+void combine_categorical_runs::compute_combinatorial_uniques(
+    const std::vector<std::string> &model_matrix_filenames,
+    combinatorial_counts &res) {  // NOLINT
+  std::string line = "", fid = "", iid = "";
+  unsigned pheno = 0;
+  // for each filename, determine what comparison is being considered
+  std::vector<unsigned> comparisons_by_filename(model_matrix_filenames.size(),
+                                                0);
+  unsigned max_comparison = 0;
+  for (unsigned i = 0; i < model_matrix_filenames.size(); ++i) {
+    comparisons_by_filename.at(i) =
+        get_comparison_number(model_matrix_filenames.at(i));
+    if (max_comparison < comparisons_by_filename.at(i))
+      max_comparison = comparisons_by_filename.at(i);
+  }
+  // for each filename within each comparison, count up the total number of
+  // subjects and the total number of alternate condition subjects
+  std::vector<std::map<std::string, std::pair<unsigned, unsigned> > >
+      subjects_by_file;
+  subjects_by_file.resize(max_comparison + 1);
+  res.clear();
+  res.resize(max_comparison + 1);
+  for (unsigned i = 0; i < model_matrix_filenames.size(); ++i) {
+    finter::finter_reader *input = 0;
+    try {
+      input = finter::reconcile_reader(
+          model_matrix_filenames.at(i));
+      input->getline(&line);
+      unsigned n_total = 0, n_alternate = 0;
+      while (input->getline(&line)) {
+        std::istringstream strm1(line);
+        if (!(strm1 >> fid >> iid >> pheno))
+          throw std::domain_error("cannot parse file \"" +
+                                  model_matrix_filenames.at(i) + "\" line \"" +
+                                  line + "\"");
+        if (pheno == 1) {
+          ++n_alternate;
+        }
+        ++n_total;
+      }
+      input->close();
+      delete input;
+      input = 0;
+      subjects_by_file.at(
+          comparisons_by_filename.at(i))[model_matrix_filenames.at(i)] =
+          std::make_pair(n_total, n_alternate);
+    } catch (...) {
+      if (input) delete input;
+      throw;
+    }
+  }
+  // for each comparison group
+  for (unsigned comp = 1; comp < subjects_by_file.size(); ++comp) {
+    // for each non-empty combination of files within that comparison group
+    for (unsigned i = 1;
+         i <
+         static_cast<unsigned>(pow(2, subjects_by_file.at(comp).size()) + 0.5);
+         ++i) {
+      std::map<std::string, std::pair<unsigned, unsigned> > alternate_lookup;
+      unsigned map_count = 0, running_total_cases = 0,
+               running_total_controls = 0;
+      for (std::map<std::string, std::pair<unsigned, unsigned> >::const_iterator
+               iter = subjects_by_file.at(comp).begin();
+           iter != subjects_by_file.at(comp).end(); ++iter, ++map_count) {
+        // add this file's totals to the running totals if required for this
+        // combination
+        if (i & (1 << map_count)) {
+          running_total_cases += iter->second.second;
+          running_total_controls += iter->second.first - iter->second.second;
+          alternate_lookup[iter->first.substr(iter->first.rfind("/") + 1)] =
+              iter->second;
+        }
+      }
+      // this solution regrettably assumes there will not be random collisions
+      // in total subject counts between different combinations at least the
+      // assumption is detectable when wrong
+      if (res.at(comp).find(
+              std::make_pair(running_total_cases, running_total_controls)) !=
+          res.at(comp).end()) {
+        std::ostringstream o_exception;
+        o_exception << "hackjob sample size resolution failed due to "
+                       "coincidental collision of total sample sizes: size is "
+                    << running_total_cases << " cases and "
+                    << running_total_controls << " controls" << std::endl;
+        o_exception << "previously stored values are:";
+        for (std::map<std::pair<unsigned, unsigned>,
+                      std::map<std::string, std::pair<unsigned, unsigned> > >::
+                 const_iterator except_iter = res.at(comp).begin();
+             except_iter != res.at(comp).end(); ++except_iter) {
+          o_exception << ' ' << except_iter->first.first << '/'
+                      << except_iter->first.second;
+        }
+        throw std::runtime_error(o_exception.str());
+      }
+      res.at(
+          comp)[std::make_pair(running_total_cases, running_total_controls)] =
+          alternate_lookup;
+    }
+  }
+}
+
+bool combine_categorical_runs::comparison_name_sort(
+    const std::string &filename1, const std::string &filename2) {
+  unsigned comp1 = get_comparison_number(filename1);
+  unsigned comp2 = get_comparison_number(filename2);
+  return comp1 < comp2;
+}
@@ -0,0 +1,88 @@
+/*!
+ \file process.h
+ \brief file-based driver functions for combining SAIGE categorical runs
+ \copyright Released under the MIT License.
+ Copyright 2021 Cameron Palmer
+ */
+
+#ifndef COMBINE_CATEGORICAL_RUNS_PROCESS_H_
+#define COMBINE_CATEGORICAL_RUNS_PROCESS_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "combine_categorical_runs/combiner.h"
+#include "combine_categorical_runs/consensus.h"
+#include "combine_categorical_runs/output_filter.h"
+
+namespace combine_categorical_runs {
+/*!
+  \brief combine SAIGE output files into a single consensus output file
+  @param input_filenames SAIGE output files, in output column order
+  @param output_filename name of combined output file
+  @param consensus filter restricting inputs to consensus variants
+  @param combinatorial_file_counts combinatorial sample size lookup
+  @param report_datasets whether to append a DATASETS column
+  @param filter_settings criteria for reporting rows
+  @param decompression_threads threads for decompressing each gzip input
+ */
+void process_data(const std::vector<std::string> &input_filenames,
+                  const std::string &output_filename,
+                  consensus_filter *consensus,
+                  const combinatorial_counts &combinatorial_file_counts,
+                  bool report_datasets,
+                  const output_filter_settings &filter_settings,
+                  unsigned decompression_threads = 1);
+
+/*!
+  \brief extend existing combined output with one new comparison
+  @param combined_filename existing output, written with DATASETS column
+  @param input_filename SAIGE output file for the new comparison, which
+  must be numbered after every comparison already in the existing output
+  @param output_filename name of new combined output file
+  @param consensus filter restricting both inputs to shared variants
+  @param combinatorial_file_counts combinatorial sample size lookup for the
+  new comparison
+  @param filter_settings criteria for reporting rows
+  @param decompression_threads threads for decompressing each gzip input
+ */
+void process_incremental(const std::string &combined_filename,
+                         const std::string &input_filename,
+                         const std::string &output_filename,
+                         consensus_filter *consensus,
+                         const combinatorial_counts &combinatorial_file_counts,
+                         const output_filter_settings &filter_settings,
+                         unsigned decompression_threads = 1);
+
+/*!
+  \brief count occurrences of each variant ID in a SAIGE output file
+  @param filename SAIGE output file
+  @param target running count of variant IDs; updated
+  @param decompression_threads threads for decompressing gzip input
+ */
+void find_consensus_variants(const std::string &filename,
+                             std::map<std::string, unsigned> *target,
+                             unsigned decompression_threads = 1);
+
+/*!
+  \brief determine sample size of every combination of datasets within each
+  comparison
+  @param model_matrix_filenames model matrix files, in comparison#/ paths
+  @param res combinatorial sample size lookup; overwritten
+ */
+void compute_combinatorial_uniques(
+    const std::vector<std::string> &model_matrix_filenames,
+    combinatorial_counts &res);  // NOLINT
+
+/*!
+  \brief order filenames by comparison number
+  @param filename1 first filename
+  @param filename2 second filename
+  \return whether the first comparison number is smaller
+ */
+bool comparison_name_sort(const std::string &filename1,
+                          const std::string &filename2);
+}  // namespace combine_categorical_runs
+
+#endif  // COMBINE_CATEGORICAL_RUNS_PROCESS_H_
@@ -0,0 +1,19 @@
+/*!
+  \file utilities.cc
+  \brief implementation of shared helpers
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include "combine_categorical_runs/utilities.h"
+
+unsigned combine_categorical_runs::get_comparison_number(
+    const std::string &filename) {
+  if (filename.find("comparison") == std::string::npos)
+    throw std::domain_error("comparison directory format not recognized: \"" +
+                            filename + "\"");
+  std::string truncated = filename.substr(filename.rfind("comparison") + 10);
+  unsigned res =
+      from_string<unsigned>(truncated.substr(0, truncated.find("/")));
+  return res;
+}
@@ -0,0 +1,52 @@
+/*!
+ \file utilities.h
+ \brief string conversion and filename helpers shared across the library
+ \copyright Released under the MIT License.
+ Copyright 2021 Cameron Palmer
+ */
+
+#ifndef COMBINE_CATEGORICAL_RUNS_UTILITIES_H_
+#define COMBINE_CATEGORICAL_RUNS_UTILITIES_H_
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace combine_categorical_runs {
+/*!
+  \brief convert a string to an arbitrary streamable type
+  @tparam value_type class to which the string should be converted
+  @param str string to convert
+  \return converted value
+ */
+template <class value_type>
+value_type from_string(const std::string &str) {
+  std::istringstream strm1(str);
+  value_type res;
+  if (!(strm1 >> res))
+    throw std::domain_error("cannot convert string to object: \"" + str + "\"");
+  return res;
+}
+
+/*!
+  \brief convert an arbitrary streamable object to a string
+  @tparam value_type class of object to convert
+  @param obj object to convert
+  \return string representation of object
+ */
+template <class value_type>
+std::string to_string(const value_type &obj) {
+  std::ostringstream o;
+  if (!(o << obj)) throw std::domain_error("cannot convert object to string");
+  return o.str();
+}
+
+/*!
+  \brief extract the comparison number from a "comparison#/" path component
+  @param filename path containing a comparison directory
+  \return comparison number
+ */
+unsigned get_comparison_number(const std::string &filename);
+}  // namespace combine_categorical_runs
+
+#endif  // COMBINE_CATEGORICAL_RUNS_UTILITIES_H_
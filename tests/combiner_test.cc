@@ -0,0 +1,226 @@
+/*!
+  \file combiner_test.cc
+  \brief agreement of every combiner input mode with file-based combining
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "combine_categorical_runs/combiner.h"
+#include "combine_categorical_runs/consensus.h"
+#include "combine_categorical_runs/output_filter.h"
+#include "combine_categorical_runs/process.h"
+#include "tests/fixtures.h"
+#include "tests/tap.h"
+
+namespace {
+using combine_categorical_runs::combined_record;
+using combine_categorical_runs::combiner;
+using combine_categorical_runs::comparison_record;
+using combine_categorical_runs_tests::comparison_files;
+
+/*!
+  \brief read a whole file as text
+  @param filename file to read
+  \return file contents
+ */
+std::string read_text(const std::string &filename) {
+  std::ifstream input(filename.c_str());
+  std::ostringstream o;
+  o << input.rdbuf();
+  return o.str();
+}
+
+/*!
+  \brief parse the data lines of a SAIGE file into records
+
+  Rows whose statistics cannot be parsed, such as SAIGE's NA rows, carry
+  only their variant ID, as a caller would supply for rows it cannot use.
+ */
+std::vector<comparison_record> read_records(const std::string &filename) {
+  std::vector<std::string> lines =
+      combine_categorical_runs_tests::read_lines(filename);
+  std::vector<comparison_record> res(lines.empty() ? 0 : lines.size() - 1);
+  for (unsigned i = 1; i < lines.size(); ++i) {
+    try {
+      combine_categorical_runs::parse_comparison_record(lines.at(i), filename,
+                                                        &res.at(i - 1));
+    } catch (const std::domain_error &) {
+      res.at(i - 1) = comparison_record();
+      combine_categorical_runs::parse_variant_id(lines.at(i), filename,
+                                                 &res.at(i - 1).variant_id);
+    }
+  }
+  return res;
+}
+
+/*!
+  \brief collect combiner output as formatted lines
+ */
+struct collector {
+  std::vector<std::string> lines;  //!< formatted combined records
+  combiner::record_callback callback() {
+    return [this](const combined_record &record) {
+      lines.push_back(
+          combine_categorical_runs::format_combined_record(record, true));
+    };
+  }
+};
+}  // namespace
+
+int main() {
+  combine_categorical_runs_tests::tap_reporter tap;
+  boost::filesystem::path directory =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("combiner_test-%%%%-%%%%-%%%%");
+  boost::filesystem::create_directories(directory);
+  try {
+    combine_categorical_runs_tests::lcg generator(41);
+    std::vector<comparison_files> comparisons;
+    std::vector<std::string> inputs, model_matrices;
+    std::vector<unsigned> comparison_numbers;
+    for (unsigned i = 1; i <= 3; ++i) {
+      comparisons.push_back(combine_categorical_runs_tests::write_comparison(
+          directory.string(), i, 700, &generator));
+      inputs.push_back(comparisons.back().saige);
+      model_matrices.insert(model_matrices.end(),
+                            comparisons.back().model_matrices.begin(),
+                            comparisons.back().model_matrices.end());
+      comparison_numbers.push_back(i);
+    }
+    std::string full = (directory / "full.tsv").string();
+    combine_categorical_runs_tests::combine_comparisons(
+        comparisons, full, true,
+        combine_categorical_runs::output_filter_settings());
+    std::vector<std::string> expected =
+        combine_categorical_runs_tests::read_lines(full);
+    if (!expected.empty()) expected.erase(expected.begin());
+
+    combine_categorical_runs::combinatorial_counts counts;
+    combine_categorical_runs::compute_combinatorial_uniques(model_matrices,
+                                                            counts);
+    std::vector<std::vector<comparison_record> > records;
+    std::map<std::string, unsigned> variants;
+    for (unsigned i = 0; i < inputs.size(); ++i) {
+      records.push_back(read_records(inputs.at(i)));
+      combine_categorical_runs::count_variant_ids(records.back(), &variants);
+    }
+    combine_categorical_runs::map_consensus_filter consensus(variants,
+                                                             inputs.size());
+
+    // push parsed records in turn, one per input
+    collector pushed;
+    combiner push_engine(comparison_numbers, counts, pushed.callback(),
+                         &consensus);
+    unsigned longest = 0;
+    for (unsigned i = 0; i < records.size(); ++i) {
+      if (records.at(i).size() > longest) longest = records.at(i).size();
+    }
+    for (unsigned j = 0; j < longest; ++j) {
+      for (unsigned i = 0; i < records.size(); ++i) {
+        if (j < records.at(i).size()) push_engine.push(i, records.at(i).at(j));
+      }
+    }
+    bool complete_before_finish = push_engine.complete();
+    for (unsigned i = 0; i < records.size(); ++i) push_engine.finish(i);
+    tap.ok(expected.size() > 10 && pushed.lines == expected,
+           "push output matches process_data");
+    tap.ok(!complete_before_finish && push_engine.complete(),
+           "combination is complete only once every input finishes");
+
+    // push raw text, with lines split across buffers of differing sizes
+    collector buffered;
+    combiner buffer_engine(comparison_numbers, counts, buffered.callback(),
+                           &consensus);
+    std::vector<std::string> texts;
+    std::vector<std::string::size_type> offsets(inputs.size(), 0);
+    for (unsigned i = 0; i < inputs.size(); ++i) {
+      texts.push_back(read_text(inputs.at(i)));
+    }
+    // the last input ends without a newline, so finish() flushes its row
+    texts.back().erase(texts.back().size() - 1);
+    bool more = true;
+    while (more) {
+      more = false;
+      for (unsigned i = 0; i < texts.size(); ++i) {
+        std::string::size_type size = 5 + 17 * i + generator.next() % 61;
+        if (offsets.at(i) >= texts.at(i).size()) continue;
+        buffer_engine.push_buffer(i, texts.at(i).substr(offsets.at(i), size));
+        offsets.at(i) += size;
+        more = true;
+      }
+    }
+    for (unsigned i = 0; i < texts.size(); ++i) buffer_engine.finish(i);
+    tap.ok(buffered.lines == expected && buffer_engine.complete(),
+           "push_buffer output matches process_data");
+
+    // pull parsed records
+    collector pulled;
+    combiner pull_engine(comparison_numbers, counts, pulled.callback(),
+                         &consensus);
+    std::vector<unsigned> positions(records.size(), 0);
+    std::vector<combiner::record_source> record_sources;
+    for (unsigned i = 0; i < records.size(); ++i) {
+      record_sources.push_back([&records, &positions, i](
+                                   comparison_record *record) {
+        if (positions.at(i) >= records.at(i).size()) return false;
+        *record = records.at(i).at(positions.at(i)++);
+        return true;
+      });
+    }
+    pull_engine.pull(record_sources);
+    tap.ok(pulled.lines == expected && pull_engine.complete(),
+           "pull output matches process_data");
+
+    // pull raw data lines
+    collector pulled_lines;
+    combiner line_engine(comparison_numbers, counts, pulled_lines.callback(),
+                         &consensus);
+    std::vector<std::vector<std::string> > lines;
+    for (unsigned i = 0; i < inputs.size(); ++i) {
+      lines.push_back(combine_categorical_runs_tests::read_lines(inputs.at(i)));
+      positions.at(i) = 1;
+    }
+    std::vector<combiner::line_source> line_sources;
+    for (unsigned i = 0; i < lines.size(); ++i) {
+      line_sources.push_back([&lines, &positions, i](std::string *line) {
+        if (positions.at(i) >= lines.at(i).size()) return false;
+        *line = lines.at(i).at(positions.at(i)++);
+        return true;
+      });
+    }
+    line_engine.pull_lines(line_sources);
+    tap.ok(pulled_lines.lines == expected && line_engine.complete(),
+           "pull_lines output matches process_data");
+
+    bool has_na_rows = false;
+    for (unsigned i = 1; i < lines.at(0).size(); ++i) {
+      if (lines.at(0).at(i).find("\tNA\t") != std::string::npos)
+        has_na_rows = true;
+    }
+    tap.ok(has_na_rows, "inputs include rows with NA statistics");
+
+    tap.throws<std::logic_error>(
+        [&]() { push_engine.push(0, records.at(0).at(0)); },
+        "pushing to a finished input is refused");
+    tap.throws<std::domain_error>(
+        [&]() {
+          combiner unfiltered(comparison_numbers, counts, pushed.callback(),
+                              0);
+        },
+        "a combiner requires a consensus filter");
+  } catch (const std::exception &e) {
+    tap.ok(false, std::string("unexpected exception: ") + e.what());
+  }
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(directory, ec);
+  return tap.finish();
+}
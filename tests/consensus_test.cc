@@ -0,0 +1,166 @@
+/*!
+  \file consensus_test.cc
+  \brief agreement of consensus filter implementations and external sorting
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "combine_categorical_runs/consensus.h"
+#include "combine_categorical_runs/external_sorter.h"
+#include "combine_categorical_runs/process.h"
+#include "tests/fixtures.h"
+#include "tests/tap.h"
+
+namespace {
+using combine_categorical_runs_tests::lcg;
+using combine_categorical_runs_tests::write_saige_file;
+
+/*!
+  \brief budget small enough that the sorters below spill well over 64 runs
+ */
+const unsigned long tiny_budget = 500;
+
+/*!
+  \brief sortable integer with the interface external_sorter requires
+ */
+struct sort_key {
+  unsigned long value;
+  bool operator<(const sort_key &obj) const { return value < obj.value; }
+  unsigned long memory_footprint() const { return 0; }
+};
+
+std::ostream &operator<<(std::ostream &out, const sort_key &obj) {
+  return out << obj.value;
+}
+
+std::istream &operator>>(std::istream &in, sort_key &obj) {
+  return in >> obj.value;
+}
+
+/*!
+  \brief sortable string that owns heap memory once long enough
+ */
+struct text_key {
+  std::string value;
+  bool operator<(const text_key &obj) const { return value < obj.value; }
+  unsigned long memory_footprint() const {
+    return combine_categorical_runs::string_heap_footprint(value);
+  }
+};
+
+std::ostream &operator<<(std::ostream &out, const text_key &obj) {
+  return out << obj.value;
+}
+
+std::istream &operator>>(std::istream &in, text_key &obj) {
+  return in >> obj.value;
+}
+
+}  // namespace
+
+int main() {
+  combine_categorical_runs_tests::tap_reporter tap;
+  boost::filesystem::path directory =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("consensus_test-%%%%-%%%%-%%%%");
+  boost::filesystem::create_directories(directory);
+  try {
+    // sorter alone, forced through an intermediate merge pass
+    {
+      combine_categorical_runs::external_sorter<sort_key> sorter(
+          (directory / "sort").string(), tiny_budget);
+      std::vector<unsigned long> expected;
+      lcg generator(17);
+      sort_key key;
+      for (unsigned i = 0; i < 5000; ++i) {
+        key.value = generator.next() % 1000;
+        expected.push_back(key.value);
+        sorter.push(key);
+      }
+      std::sort(expected.begin(), expected.end());
+      tap.ok(sorter.spilled(), "external_sorter spills under a tiny budget");
+      std::vector<unsigned long> observed;
+      while (sorter.pop(&key)) observed.push_back(key.value);
+      tap.ok(observed == expected,
+             "external_sorter output matches in-memory sort across more than "
+             "64 runs");
+    }
+    // buffer accounting, including string allocations and array capacity
+    {
+      combine_categorical_runs::external_sorter<text_key> sorter(
+          (directory / "text").string(), 1ul << 20);
+      lcg generator(23);
+      text_key key;
+      unsigned long string_bytes = 0;
+      for (unsigned i = 0; i < 100; ++i) {
+        std::ostringstream o;
+        o << "chr1:" << (1000000000ul + generator.next()) << ":A:G";
+        key.value = o.str();
+        string_bytes += key.value.size() + 1;
+        sorter.push(key);
+      }
+      tap.ok(!sorter.spilled() &&
+                 sorter.memory_usage() >= string_bytes + 100 * sizeof(text_key),
+             "external_sorter counts string contents and buffer capacity");
+      sorter.finalize();
+      while (sorter.pop(&key)) {
+      }
+      tap.ok(!sorter.memory_usage(),
+             "external_sorter frees its in-memory buffer once exhausted");
+    }
+    // consensus filters over a shared set of input files
+    std::vector<std::string> filenames;
+    std::vector<std::vector<std::string> > ids;
+    lcg generator(29);
+    for (unsigned i = 0; i < 4; ++i) {
+      std::ostringstream name;
+      name << (directory / "input").string() << i << ".txt";
+      filenames.push_back(name.str());
+      ids.push_back(write_saige_file(filenames.back(), 400, &generator));
+    }
+    std::map<std::string, unsigned> counts;
+    for (unsigned i = 0; i < filenames.size(); ++i) {
+      combine_categorical_runs::find_consensus_variants(filenames.at(i),
+                                                        &counts);
+    }
+    combine_categorical_runs::map_consensus_filter reference(counts,
+                                                             filenames.size());
+    boost::filesystem::path scratch = directory / "scratch";
+    boost::filesystem::create_directories(scratch);
+    {
+      combine_categorical_runs::spilled_consensus_filter spilled(
+          filenames, tiny_budget, scratch.string());
+      tap.ok(reference.complete_variant_count() > 0,
+             "test inputs share some variants");
+      tap.ok(spilled.complete_variant_count() ==
+                 reference.complete_variant_count(),
+             "spilled_consensus_filter complete_variant_count matches map");
+      bool spilled_agrees = true;
+      // interleave files, as the combining pass does
+      for (unsigned line = 0; line < 400; ++line) {
+        for (unsigned i = 0; i < ids.size(); ++i) {
+          if (line >= ids.at(i).size()) continue;
+          const std::string &id = ids.at(i).at(line);
+          bool expected = reference.retain(i, id);
+          if (spilled.retain(i, id) != expected) spilled_agrees = false;
+        }
+      }
+      tap.ok(spilled_agrees, "spilled_consensus_filter retain matches map");
+    }
+    tap.ok(boost::filesystem::is_empty(scratch),
+           "spilled_consensus_filter removes its scratch files");
+  } catch (const std::exception &e) {
+    tap.ok(false, std::string("unexpected exception: ") + e.what());
+  }
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(directory, ec);
+  return tap.finish();
+}
@@ -0,0 +1,237 @@
+/*!
+ \file fixtures.h
+ \brief synthetic SAIGE comparisons and model matrices for unit test programs
+ \copyright Released under the MIT License.
+ Copyright 2021 Cameron Palmer
+ */
+
+#ifndef TESTS_FIXTURES_H_
+#define TESTS_FIXTURES_H_
+
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "combine_categorical_runs/consensus.h"
+#include "combine_categorical_runs/output_filter.h"
+#include "combine_categorical_runs/process.h"
+
+namespace combine_categorical_runs_tests {
+/*!
+  \class lcg
+  \brief deterministic pseudorandom sequence, so failures reproduce
+ */
+class lcg {
+ public:
+  explicit lcg(unsigned long seed) : _state(seed) {}
+  unsigned long next() {
+    _state = _state * 6364136223846793005ul + 1442695040888963407ul;
+    return _state >> 33;
+  }
+
+ private:
+  unsigned long _state;  //!< generator state
+};
+
+/*!
+  \brief files describing one comparison
+ */
+struct comparison_files {
+  std::string saige;                        //!< SAIGE output file
+  std::vector<std::string> model_matrices;  //!< model matrix files
+};
+
+/*!
+  \brief write a model matrix with a given number of alternate subjects
+  @param filename file to write
+  @param n_total number of subjects
+  @param n_alternate number of subjects with phenotype 1
+ */
+inline void write_model_matrix(const std::string &filename, unsigned n_total,
+                               unsigned n_alternate) {
+  std::ofstream output(filename.c_str());
+  output << "FID IID pheno" << std::endl;
+  for (unsigned i = 0; i < n_total; ++i) {
+    output << 'f' << i << " i" << i << ' ' << (i < n_alternate ? 1 : 0)
+           << std::endl;
+  }
+}
+
+/*!
+  \brief write a comparison directory with two datasets and a SAIGE file
+  @param root directory in which to create "comparison#/"
+  @param comparison comparison number
+  @param pool_size number of distinct variants to draw from
+  @param generator random source
+  \return names of files written
+
+  About 80% of the pool is written, in pool order, with random allele order,
+  effects and p-values, and sample sizes drawn from the datasets' possible
+  combinations. Some variants are written by every comparison and repeated
+  by comparison 1, so their count never equals the number of inputs and
+  they are never consensus. Comparison 1 also has variants of its own whose
+  statistics are NA, as SAIGE writes for variants it could not test.
+ */
+inline comparison_files write_comparison(const std::string &root,
+                                         unsigned comparison,
+                                         unsigned pool_size, lcg *generator) {
+  comparison_files res;
+  std::ostringstream directory_name;
+  directory_name << root << "/comparison" << comparison;
+  boost::filesystem::create_directories(directory_name.str());
+  // dataset sizes chosen so that no two combinations share a sample size
+  unsigned n_total[2] = {100 + 7 * comparison, 1000 + 11 * comparison};
+  unsigned n_alternate[2] = {30 + comparison, 200 + comparison};
+  for (unsigned i = 0; i < 2; ++i) {
+    std::ostringstream name;
+    name << directory_name.str() << "/ds" << i << ".model_matrix";
+    write_model_matrix(name.str(), n_total[i], n_alternate[i]);
+    res.model_matrices.push_back(name.str());
+  }
+  res.saige = directory_name.str() + "/saige.txt";
+  std::ofstream output(res.saige.c_str());
+  output << "CHR\tPOS\tSNPID\tAllele1\tAllele2\tAF_Allele2\tBETA\tSE\tp.value"
+            "\tTstat\tvar\tN.Cases\tN.Controls"
+         << std::endl;
+  for (unsigned i = 0; i < pool_size; ++i) {
+    if (comparison == 1 && i % 13 == 5) {
+      output << "1\t" << (1000 + i) << "\trsNA" << i
+             << "\tA\tC\t0.3\tNA\tNA\tNA\tNA\tNA\tNA\tNA" << std::endl;
+    }
+    bool repeated = i % 97 == 11;
+    if (generator->next() % 10 < 2 && !repeated) continue;
+    unsigned subset = 1 + generator->next() % 3;
+    unsigned cases = 0, controls = 0;
+    for (unsigned j = 0; j < 2; ++j) {
+      if (subset & (1 << j)) {
+        cases += n_alternate[j];
+        controls += n_total[j] - n_alternate[j];
+      }
+    }
+    bool swapped = generator->next() % 2;
+    double beta = (static_cast<double>(generator->next() % 2000) - 1000.0) /
+                  997.0;
+    double pvalue =
+        std::pow(10.0, -static_cast<double>(generator->next() % 12000) / 997.0);
+    unsigned copies = repeated && comparison == 1 ? 2 : 1;
+    for (unsigned c = 0; c < copies; ++c) {
+      output << "1\t" << (1000 + i) << "\trs" << i << '\t'
+             << (swapped ? "G\tA" : "A\tG") << "\t0.3\t" << beta << "\t0.1\t"
+             << pvalue << "\t0.5\t1\t" << cases << '\t' << controls
+             << std::endl;
+    }
+  }
+  return res;
+}
+
+/*!
+  \brief write a SAIGE-like file over a random subset of a variant pool
+  @param filename file to write
+  @param pool_size number of distinct variants to draw from
+  @param generator random source
+  \return allele-sorted variant ID of each data line, in file order
+
+  Some variants are written with swapped alleles or repeated, so that both
+  ID normalization and overcounted IDs are exercised.
+ */
+inline std::vector<std::string> write_saige_file(const std::string &filename,
+                                                 unsigned pool_size,
+                                                 lcg *generator) {
+  std::vector<std::string> ids;
+  std::ofstream output(filename.c_str());
+  output << "CHR\tPOS\tSNPID\tAllele1\tAllele2\tAF_Allele2\tBETA\tSE\tp.value"
+            "\tTstat\tvar\tN.Cases\tN.Controls"
+         << std::endl;
+  for (unsigned i = 0; i < pool_size; ++i) {
+    unsigned draw = generator->next() % 10;
+    if (draw < 2) continue;
+    unsigned copies = draw == 9 ? 2 : 1;
+    std::ostringstream id;
+    id << "rs" << i;
+    bool swapped = generator->next() % 2;
+    for (unsigned c = 0; c < copies; ++c) {
+      output << "1\t" << (1000 + i) << '\t' << id.str() << '\t'
+             << (swapped ? "G\tA" : "A\tG")
+             << "\t0.3\t0.1\t0.01\t0.5\t1\t1\t100\t200" << std::endl;
+      ids.push_back(id.str() + ":A:G");
+    }
+  }
+  return ids;
+}
+/*!
+  \brief combine comparisons from scratch, as the command line program does
+  @param comparisons comparisons to combine, in comparison order
+  @param output_filename name of combined output file
+  @param report_datasets whether to append a DATASETS column
+  @param settings criteria for reporting rows
+ */
+inline void combine_comparisons(
+    const std::vector<comparison_files> &comparisons,
+    const std::string &output_filename, bool report_datasets,
+    const combine_categorical_runs::output_filter_settings &settings) {
+  std::vector<std::string> inputs, model_matrices;
+  for (unsigned i = 0; i < comparisons.size(); ++i) {
+    inputs.push_back(comparisons.at(i).saige);
+    model_matrices.insert(model_matrices.end(),
+                          comparisons.at(i).model_matrices.begin(),
+                          comparisons.at(i).model_matrices.end());
+  }
+  combine_categorical_runs::combinatorial_counts counts;
+  combine_categorical_runs::compute_combinatorial_uniques(model_matrices,
+                                                          counts);
+  std::map<std::string, unsigned> variants;
+  for (unsigned i = 0; i < inputs.size(); ++i) {
+    combine_categorical_runs::find_consensus_variants(inputs.at(i), &variants);
+  }
+  combine_categorical_runs::map_consensus_filter consensus(variants,
+                                                           inputs.size());
+  combine_categorical_runs::process_data(inputs, output_filename, &consensus,
+                                         counts, report_datasets, settings);
+}
+
+/*!
+  \brief read a text file into lines
+  @param filename file to read
+  \return lines of file, without newlines
+ */
+inline std::vector<std::string> read_lines(const std::string &filename) {
+  std::vector<std::string> res;
+  std::ifstream input(filename.c_str());
+  std::string line = "";
+  while (std::getline(input, line)) res.push_back(line);
+  return res;
+}
+
+/*!
+  \brief extract one named column from tab-delimited lines with a header
+  @param lines header and data lines
+  @param name header entry of column
+  \return column values of data lines
+ */
+inline std::vector<std::string> column(const std::vector<std::string> &lines,
+                                       const std::string &name) {
+  std::vector<std::string> res, tokens;
+  std::string token = "";
+  unsigned index = 0;
+  for (unsigned i = 0; i < lines.size(); ++i) {
+    tokens.clear();
+    std::istringstream strm1(lines.at(i));
+    while (std::getline(strm1, token, '\t')) tokens.push_back(token);
+    if (!i) {
+      while (index < tokens.size() && tokens.at(index).compare(name)) ++index;
+      if (index == tokens.size())
+        throw std::domain_error("column: no column \"" + name + "\"");
+    } else {
+      res.push_back(tokens.at(index));
+    }
+  }
+  return res;
+}
+}  // namespace combine_categorical_runs_tests
+
+#endif  // TESTS_FIXTURES_H_
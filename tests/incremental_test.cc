@@ -0,0 +1,140 @@
+/*!
+  \file incremental_test.cc
+  \brief agreement of incremental extension with a full combining run
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "combine_categorical_runs/consensus.h"
+#include "combine_categorical_runs/output_filter.h"
+#include "combine_categorical_runs/process.h"
+#include "tests/fixtures.h"
+#include "tests/tap.h"
+
+namespace {
+using combine_categorical_runs_tests::column;
+using combine_categorical_runs_tests::combine_comparisons;
+using combine_categorical_runs_tests::comparison_files;
+
+/*!
+  \brief extend existing combined output with one comparison
+  @param combined_filename existing combined output
+  @param comparison comparison to add
+  @param output_filename name of extended output file
+ */
+void run_incremental(const std::string &combined_filename,
+                     const comparison_files &comparison,
+                     const std::string &output_filename) {
+  combine_categorical_runs::combinatorial_counts counts;
+  combine_categorical_runs::compute_combinatorial_uniques(
+      comparison.model_matrices, counts);
+  std::map<std::string, unsigned> variants;
+  combine_categorical_runs::find_consensus_variants(combined_filename,
+                                                    &variants);
+  combine_categorical_runs::find_consensus_variants(comparison.saige,
+                                                    &variants);
+  combine_categorical_runs::map_consensus_filter consensus(variants, 2);
+  combine_categorical_runs::process_incremental(
+      combined_filename, comparison.saige, output_filename, &consensus, counts,
+      combine_categorical_runs::output_filter_settings());
+}
+}  // namespace
+
+int main() {
+  combine_categorical_runs_tests::tap_reporter tap;
+  boost::filesystem::path directory =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("incremental_test-%%%%-%%%%-%%%%");
+  boost::filesystem::create_directories(directory);
+  try {
+    combine_categorical_runs_tests::lcg generator(31);
+    std::vector<comparison_files> comparisons;
+    for (unsigned i = 1; i <= 3; ++i) {
+      comparisons.push_back(combine_categorical_runs_tests::write_comparison(
+          directory.string(), i, 600, &generator));
+    }
+    combine_categorical_runs::output_filter_settings unfiltered;
+    std::string full = (directory / "full.tsv").string();
+    combine_comparisons(comparisons, full, true, unfiltered);
+    std::vector<comparison_files> first_two(comparisons.begin(),
+                                            comparisons.begin() + 2);
+    std::string partial = (directory / "partial.tsv").string();
+    combine_comparisons(first_two, partial, true, unfiltered);
+    std::string extended = (directory / "extended.tsv").string();
+    run_incremental(partial, comparisons.at(2), extended);
+
+    std::vector<std::string> full_lines =
+        combine_categorical_runs_tests::read_lines(full);
+    std::vector<std::string> extended_lines =
+        combine_categorical_runs_tests::read_lines(extended);
+    tap.ok(full_lines.size() > 1 && full_lines.size() == extended_lines.size(),
+           "incremental output has the same rows as a full run");
+    tap.ok(!full_lines.empty() && !extended_lines.empty() &&
+               full_lines.at(0) == extended_lines.at(0),
+           "incremental output has the same header as a full run");
+    tap.ok(column(full_lines, "N") == column(extended_lines, "N") &&
+               column(full_lines, "DATASETS") ==
+                   column(extended_lines, "DATASETS"),
+           "incremental N and DATASETS match a full run");
+    tap.ok(column(full_lines, "P_CONSENSUS") ==
+               column(extended_lines, "P_CONSENSUS"),
+           "incremental P_CONSENSUS matches a full run exactly");
+    tap.ok(full_lines == extended_lines,
+           "incremental output is identical to a full run");
+
+    std::string bare = (directory / "bare.tsv").string();
+    combine_comparisons(first_two, bare, false, unfiltered);
+    tap.throws<std::domain_error>(
+        [&]() {
+          run_incremental(bare, comparisons.at(2),
+                          (directory / "x.tsv").string());
+        },
+        "output without DATASETS cannot be extended");
+
+    combine_categorical_runs::output_filter_settings filtered;
+    filtered.max_consensus_p = 0.5;
+    std::string filtered_output = (directory / "filtered.tsv").string();
+    combine_comparisons(first_two, filtered_output, true, filtered);
+    tap.throws<std::domain_error>(
+        [&]() {
+          run_incremental(filtered_output, comparisons.at(2),
+                          (directory / "x.tsv").string());
+        },
+        "output with FILTERED_DATASETS cannot be extended");
+
+    tap.throws<std::domain_error>(
+        [&]() {
+          run_incremental(partial, comparisons.at(1),
+                          (directory / "x.tsv").string());
+        },
+        "a comparison already present cannot be added again");
+
+    std::vector<comparison_files> skipping;
+    skipping.push_back(comparisons.at(0));
+    skipping.push_back(comparisons.at(2));
+    std::string skipped = (directory / "skipped.tsv").string();
+    combine_comparisons(skipping, skipped, true, unfiltered);
+    tap.ok(combine_categorical_runs_tests::read_lines(skipped).at(0).find(
+               "\tBETA_COMP1\tBETA_COMP3\t") != std::string::npos,
+           "header columns are named by comparison number");
+    tap.throws<std::domain_error>(
+        [&]() {
+          run_incremental(skipped, comparisons.at(1),
+                          (directory / "x.tsv").string());
+        },
+        "a comparison numbered before existing ones cannot be added");
+  } catch (const std::exception &e) {
+    tap.ok(false, std::string("unexpected exception: ") + e.what());
+  }
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(directory, ec);
+  return tap.finish();
+}
@@ -0,0 +1,302 @@
+/*!
+  \file line_reader_test.cc
+  \brief decoding and error handling of multithreaded gzip line readers
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include <zlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "combine_categorical_runs/line_reader.h"
+#include "tests/tap.h"
+
+namespace {
+const unsigned n_threads = 3;  //!< decompression threads under test
+const unsigned long split_size = 16384;  //!< small spans for plain gzip
+
+/*!
+  \brief compress data as a single gzip member
+  @param data uncompressed data
+  @param level zlib compression level
+  @param strategy zlib compression strategy
+  \return gzip member
+ */
+std::string gzip_member(const std::string &data, int level = 6,
+                        int strategy = Z_DEFAULT_STRATEGY) {
+  z_stream strm;
+  strm.zalloc = Z_NULL;
+  strm.zfree = Z_NULL;
+  strm.opaque = Z_NULL;
+  if (deflateInit2(&strm, level, Z_DEFLATED, 15 + 16, 8, strategy) != Z_OK)
+    throw std::runtime_error("gzip_member: cannot initialize zlib");
+  std::string res(deflateBound(&strm, data.size()), '\0');
+  strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  strm.avail_in = data.size();
+  strm.next_out = reinterpret_cast<Bytef *>(&res[0]);
+  strm.avail_out = res.size();
+  if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+    deflateEnd(&strm);
+    throw std::runtime_error("gzip_member: compression failed");
+  }
+  res.resize(strm.total_out);
+  deflateEnd(&strm);
+  return res;
+}
+
+void append_le(std::string *target, unsigned long value, unsigned n_bytes) {
+  for (unsigned i = 0; i < n_bytes; ++i) {
+    target->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+/*!
+  \brief compress data as a single BGZF block, as bgzip writes it
+  @param data uncompressed data, at most 64KB
+  \return BGZF block
+ */
+std::string bgzf_block(const std::string &data) {
+  z_stream strm;
+  strm.zalloc = Z_NULL;
+  strm.zfree = Z_NULL;
+  strm.opaque = Z_NULL;
+  if (deflateInit2(&strm, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    throw std::runtime_error("bgzf_block: cannot initialize zlib");
+  std::string deflated(deflateBound(&strm, data.size()), '\0');
+  strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  strm.avail_in = data.size();
+  strm.next_out = reinterpret_cast<Bytef *>(&deflated[0]);
+  strm.avail_out = deflated.size();
+  if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+    deflateEnd(&strm);
+    throw std::runtime_error("bgzf_block: compression failed");
+  }
+  deflated.resize(strm.total_out);
+  deflateEnd(&strm);
+  std::string res = "";
+  const unsigned char header[] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0,
+                                  'B', 'C', 2, 0};
+  res.append(reinterpret_cast<const char *>(header), sizeof(header));
+  append_le(&res, 18 + deflated.size() + 8 - 1, 2);
+  res += deflated;
+  append_le(&res,
+            crc32(crc32(0L, Z_NULL, 0),
+                  reinterpret_cast<const Bytef *>(data.data()), data.size()),
+            4);
+  append_le(&res, data.size(), 4);
+  return res;
+}
+
+/*!
+  \brief compress data as BGZF with an empty end-of-file block
+  @param data uncompressed data
+  @param block_size uncompressed bytes per block
+  @param offsets start of each block in the result; filled
+  \return BGZF file contents
+ */
+std::string bgzf_file(const std::string &data, unsigned block_size,
+                      std::vector<std::string::size_type> *offsets) {
+  std::string res = "";
+  for (std::string::size_type i = 0; i < data.size(); i += block_size) {
+    offsets->push_back(res.size());
+    res += bgzf_block(data.substr(i, block_size));
+  }
+  return res + bgzf_block("");
+}
+
+void write_file(const std::string &filename, const std::string &contents) {
+  std::ofstream output(filename.c_str(), std::ios::binary);
+  output.write(contents.data(), contents.size());
+}
+
+/*!
+  \brief read every line of a file through a reader
+  @param reader reader to drain; closed on return
+  \return lines read
+ */
+std::vector<std::string> read_all(
+    combine_categorical_runs::line_reader *reader) {
+  std::unique_ptr<combine_categorical_runs::line_reader> owner(reader);
+  std::vector<std::string> res;
+  std::string line = "";
+  while (reader->getline(&line)) res.push_back(line);
+  reader->close();
+  return res;
+}
+
+std::vector<std::string> read_parallel(const std::string &filename) {
+  return read_all(
+      new combine_categorical_runs::parallel_gzip_reader(filename, n_threads));
+}
+
+/*!
+  \brief read plain gzip as many speculatively decoded spans
+  @param filename file to read
+  \return lines read
+ */
+std::vector<std::string> read_spans(const std::string &filename) {
+  return read_all(new combine_categorical_runs::parallel_gzip_reader(
+      filename, n_threads, split_size));
+}
+}  // namespace
+
+int main() {
+  combine_categorical_runs_tests::tap_reporter tap;
+  boost::filesystem::path directory =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("line_reader_test-%%%%-%%%%-%%%%");
+  boost::filesystem::create_directories(directory);
+  try {
+    // several decompressed chunks' worth of lines, including an empty one
+    std::vector<std::string> expected;
+    std::ostringstream o;
+    for (unsigned i = 0; i < 60000; ++i) {
+      std::ostringstream line;
+      if (i != 100)
+        line << "1\t" << (1000 + i) << "\trs" << i << "\tA\tG\t0.3";
+      expected.push_back(line.str());
+      o << line.str() << '\n';
+    }
+    const std::string text = o.str();
+    const std::string gz = (directory / "plain.gz").string();
+    write_file(gz, gzip_member(text));
+    tap.ok(combine_categorical_runs::parallel_gzip_reader::is_gzip(gz) &&
+               !combine_categorical_runs::parallel_gzip_reader::is_bgzf(gz),
+           "plain gzip is detected as gzip but not BGZF");
+    tap.ok(read_parallel(gz) == expected, "plain gzip decodes line for line");
+
+    const std::string members = (directory / "members.gz").string();
+    write_file(members, gzip_member(text.substr(0, 12345)) +
+                            gzip_member(text.substr(12345)));
+    tap.ok(read_parallel(members) == expected,
+           "concatenated gzip members decode as one stream");
+
+    const std::string padded = (directory / "padded.gz").string();
+    write_file(padded, gzip_member(text) + std::string(512, '\0'));
+    tap.ok(read_parallel(padded) == expected,
+           "zero padding after the last gzip member is ignored");
+
+    const std::string truncated_gz = (directory / "truncated.gz").string();
+    std::string gz_contents = gzip_member(text);
+    write_file(truncated_gz, gz_contents.substr(0, gz_contents.size() / 2));
+    tap.throws<std::runtime_error>(
+        [&]() { read_parallel(truncated_gz); },
+        "truncated gzip raises an error");
+
+    // plain gzip split into spans, with boundaries found speculatively
+    tap.ok(gz_contents.size() > 8 * split_size && read_spans(gz) == expected,
+           "plain gzip decoded in spans matches line for line");
+    tap.ok(read_spans(members) == expected && read_spans(padded) == expected,
+           "gzip members and padding decode the same in spans");
+    // no dynamic blocks to find, so every span is decoded in order
+    const std::string stored = (directory / "stored.gz").string();
+    write_file(stored, gzip_member(text, 0));
+    const std::string fixed = (directory / "fixed.gz").string();
+    write_file(fixed, gzip_member(text, 6, Z_FIXED));
+    tap.ok(read_spans(stored) == expected && read_spans(fixed) == expected,
+           "stored and fixed Huffman blocks decode in spans");
+    tap.throws<std::runtime_error>([&]() { read_spans(truncated_gz); },
+                                   "truncated gzip in spans raises an error");
+    std::string damaged = gz_contents;
+    for (unsigned i = 0; i < 16; ++i) damaged[5 * split_size + i] ^= 0x55;
+    const std::string damaged_file = (directory / "damaged.gz").string();
+    write_file(damaged_file, damaged);
+    tap.throws<std::runtime_error>([&]() { read_spans(damaged_file); },
+                                   "corrupt gzip in spans raises an error");
+    std::string bad_gzip_crc = gz_contents;
+    bad_gzip_crc[bad_gzip_crc.size() - 8] ^= 0xff;
+    const std::string bad_gzip_crc_file =
+        (directory / "bad_gzip_crc.gz").string();
+    write_file(bad_gzip_crc_file, bad_gzip_crc);
+    tap.throws<std::runtime_error>(
+        [&]() { read_spans(bad_gzip_crc_file); },
+        "gzip CRC mismatch in spans raises an error");
+
+    std::vector<std::string::size_type> offsets;
+    const std::string bgzf = (directory / "blocks.gz").string();
+    std::string bgzf_contents = bgzf_file(text, 10000, &offsets);
+    write_file(bgzf, bgzf_contents);
+    tap.ok(combine_categorical_runs::parallel_gzip_reader::is_bgzf(bgzf),
+           "BGZF is detected");
+    tap.ok(read_parallel(bgzf) == expected,
+           "BGZF with end-of-file block decodes line for line");
+    {
+      std::unique_ptr<combine_categorical_runs::line_reader> reader(
+          combine_categorical_runs::open_line_reader(bgzf, n_threads));
+      tap.ok(dynamic_cast<combine_categorical_runs::parallel_gzip_reader *>(
+                 reader.get()) != 0,
+             "open_line_reader uses the parallel reader for gzip input");
+    }
+
+    // damage the stored CRC of a block in the middle of the file
+    std::string bad_crc = bgzf_contents;
+    std::string::size_type middle = offsets.at(offsets.size() / 2 + 1);
+    bad_crc[middle - 8] ^= 0xff;
+    const std::string bad_crc_file = (directory / "bad_crc.gz").string();
+    write_file(bad_crc_file, bad_crc);
+    tap.throws<std::runtime_error>([&]() { read_parallel(bad_crc_file); },
+                                   "BGZF block CRC mismatch raises an error");
+
+    // damage the compressed payload of a block
+    std::string bad_data = bgzf_contents;
+    for (unsigned i = 0; i < 16; ++i) bad_data[offsets.at(3) + 18 + i] ^= 0x55;
+    const std::string bad_data_file = (directory / "bad_data.gz").string();
+    write_file(bad_data_file, bad_data);
+    tap.throws<std::runtime_error>([&]() { read_parallel(bad_data_file); },
+                                   "corrupt BGZF block raises an error");
+
+    const std::string truncated_bgzf =
+        (directory / "truncated_blocks.gz").string();
+    write_file(truncated_bgzf, bgzf_contents.substr(0, middle - 100));
+    tap.throws<std::runtime_error>(
+        [&]() { read_parallel(truncated_bgzf); },
+        "BGZF truncated mid-block raises an error");
+
+    // final line without a trailing newline
+    const std::string unterminated = text + "1\t99999\trsLAST\tA\tG\t0.3";
+    std::vector<std::string> unterminated_expected = expected;
+    unterminated_expected.push_back("1\t99999\trsLAST\tA\tG\t0.3");
+    const std::string unterminated_gz =
+        (directory / "unterminated.gz").string();
+    write_file(unterminated_gz, gzip_member(unterminated));
+    offsets.clear();
+    const std::string unterminated_bgzf =
+        (directory / "unterminated_blocks.gz").string();
+    write_file(unterminated_bgzf, bgzf_file(unterminated, 10000, &offsets));
+    tap.ok(read_parallel(unterminated_gz) == unterminated_expected,
+           "gzip final line without newline is returned");
+    tap.ok(read_parallel(unterminated_bgzf) == unterminated_expected,
+           "BGZF final line without newline is returned");
+
+    // closing early must stop background threads waiting for space
+    {
+      combine_categorical_runs::parallel_gzip_reader reader(bgzf, n_threads);
+      std::string line = "";
+      reader.getline(&line);
+      reader.close();
+      tap.ok(line == expected.at(0), "reader can be closed before the end");
+    }
+    {
+      combine_categorical_runs::parallel_gzip_reader reader(gz, n_threads,
+                                                            split_size);
+      std::string line = "";
+      reader.getline(&line);
+      reader.close();
+      tap.ok(line == expected.at(0),
+             "reader can be closed before the end of gzip spans");
+    }
+  } catch (const std::exception &e) {
+    tap.ok(false, std::string("unexpected exception: ") + e.what());
+  }
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(directory, ec);
+  return tap.finish();
+}
@@ -0,0 +1,244 @@
+/*!
+  \file output_filter_test.cc
+  \brief significance thresholds, top-K selection and filter reporting
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "combine_categorical_runs/output_filter.h"
+#include "combine_categorical_runs/utilities.h"
+#include "finter/finter.h"
+#include "tests/fixtures.h"
+#include "tests/tap.h"
+
+namespace {
+using combine_categorical_runs_tests::column;
+using combine_categorical_runs_tests::read_lines;
+
+/*!
+  \brief a formatted row offered to the filter
+ */
+struct candidate {
+  std::string chr;     //!< chromosome
+  double min_p;        //!< smallest comparison p-value
+  double consensus_p;  //!< consensus p-value
+  std::string line;    //!< formatted row
+};
+
+candidate make_candidate(const std::string &chr, double min_p,
+                         double consensus_p, const std::string &line) {
+  candidate res;
+  res.chr = chr;
+  res.min_p = min_p;
+  res.consensus_p = consensus_p;
+  res.line = line;
+  return res;
+}
+
+/*!
+  \brief offer rows to an output filter as process_data does
+  @param rows rows to offer, in input order
+  @param settings filter settings
+  @param filename file to which retained rows are written
+  @param admitted whether each row was admitted; filled
+  \return lines written
+ */
+std::vector<std::string> filter_rows(
+    const std::vector<candidate> &rows,
+    const combine_categorical_runs::output_filter_settings &settings,
+    const std::string &filename, std::vector<bool> *admitted) {
+  finter::finter_writer *output = 0;
+  combine_categorical_runs::output_filter *filter = 0;
+  try {
+    output = finter::reconcile_writer(filename);
+    filter = new combine_categorical_runs::output_filter(output, settings);
+    for (unsigned i = 0; i < rows.size(); ++i) {
+      const candidate &row = rows.at(i);
+      admitted->push_back(filter->admit(row.chr, row.min_p, row.consensus_p));
+      if (admitted->back()) filter->emit(row.line);
+    }
+    filter->flush();
+    output->close();
+    delete output;
+    output = 0;
+    if (!settings.report_filename.empty())
+      filter->write_report(settings.report_filename);
+    delete filter;
+    filter = 0;
+  } catch (...) {
+    if (filter) delete filter;
+    if (output) delete output;
+    throw;
+  }
+  return read_lines(filename);
+}
+
+/*!
+  \brief find the smallest of several p-value columns in each row
+  @param lines combined output with header
+  @param n_comparisons number of P_COMP columns, named P_COMP1 onward
+  \return smallest p-value of each data line
+ */
+std::vector<double> min_p_column(const std::vector<std::string> &lines,
+                                 unsigned n_comparisons) {
+  std::vector<double> res;
+  for (unsigned i = 1; i <= n_comparisons; ++i) {
+    std::vector<std::string> values = column(
+        lines, "P_COMP" + combine_categorical_runs::to_string<unsigned>(i));
+    res.resize(values.size(), 1.0);
+    for (unsigned j = 0; j < values.size(); ++j) {
+      double p = combine_categorical_runs::from_string<double>(values.at(j));
+      res.at(j) = std::min(res.at(j), p);
+    }
+  }
+  return res;
+}
+}  // namespace
+
+int main() {
+  combine_categorical_runs_tests::tap_reporter tap;
+  boost::filesystem::path directory =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("output_filter_test-%%%%-%%%%-%%%%");
+  boost::filesystem::create_directories(directory);
+  try {
+    std::string written = (directory / "rows.tsv").string();
+    std::vector<bool> admitted;
+    // thresholds
+    std::vector<candidate> rows;
+    rows.push_back(make_candidate("1", 0.0005, 0.005, "a"));
+    rows.push_back(make_candidate("1", 0.005, 0.005, "b"));
+    rows.push_back(make_candidate("1", 0.0005, 0.05, "c"));
+    rows.push_back(make_candidate("1", 0.001, 0.01, "d"));
+    combine_categorical_runs::output_filter_settings defaults;
+    std::vector<std::string> lines =
+        filter_rows(rows, defaults, written, &admitted);
+    tap.ok(!defaults.active() && lines.size() == 4 && lines.at(0) == "a" &&
+               lines.at(3) == "d",
+           "default settings report every row in order");
+    combine_categorical_runs::output_filter_settings thresholds;
+    thresholds.max_consensus_p = 0.01;
+    thresholds.max_min_p = 0.001;
+    admitted.clear();
+    lines = filter_rows(rows, thresholds, written, &admitted);
+    tap.ok(thresholds.active() && admitted.at(0) && !admitted.at(1) &&
+               !admitted.at(2) && admitted.at(3),
+           "thresholds admit rows with p-values at most the limits");
+    tap.ok(lines.size() == 2 && lines.at(0) == "a" && lines.at(1) == "d",
+           "only admitted rows are written");
+    {
+      finter::finter_writer *output = finter::reconcile_writer(written);
+      combine_categorical_runs::output_filter filter(output, thresholds);
+      filter.admit("1", 0.5, 0.5);
+      tap.throws<std::logic_error>([&]() { filter.emit("b"); },
+                                   "rows that were not admitted are refused");
+      output->close();
+      delete output;
+    }
+
+    // top-K eviction, ties and order
+    rows.clear();
+    double top_k_p[] = {0.5, 0.1, 0.3, 0.1, 0.05, 0.3, 0.01, 0.1};
+    for (unsigned i = 0; i < 8; ++i) {
+      rows.push_back(make_candidate(
+          i < 4 ? "1" : "2", top_k_p[i], top_k_p[i],
+          "r" + combine_categorical_runs::to_string<unsigned>(i + 1)));
+    }
+    combine_categorical_runs::output_filter_settings top_k;
+    top_k.top_k = 3;
+    top_k.report_filename = (directory / "report.tsv").string();
+    admitted.clear();
+    lines = filter_rows(rows, top_k, written, &admitted);
+    tap.ok(lines.size() == 3 && lines.at(0) == "r2" && lines.at(1) == "r5" &&
+               lines.at(2) == "r7",
+           "top-K keeps the smallest p-values and writes them in input order");
+    tap.ok(admitted.at(3) && !admitted.at(5) && !admitted.at(7),
+           "top-K refuses rows that cannot displace a held row");
+    tap.ok(std::find(lines.begin(), lines.end(), "r4") == lines.end(),
+           "top-K ties keep the earlier row");
+    std::vector<std::string> report = read_lines(top_k.report_filename);
+    tap.ok(report.size() == 3 &&
+               report.at(0) == "CHR\tN_TOTAL\tN_REPORTED\tN_FILTERED" &&
+               report.at(1) == "1\t4\t1\t3" && report.at(2) == "2\t4\t2\t2",
+           "report counts total, reported and filtered rows per chromosome");
+
+    // end to end against filtering complete output
+    combine_categorical_runs_tests::lcg generator(37);
+    std::vector<combine_categorical_runs_tests::comparison_files> comparisons;
+    for (unsigned i = 1; i <= 2; ++i) {
+      comparisons.push_back(combine_categorical_runs_tests::write_comparison(
+          directory.string(), i, 800, &generator));
+    }
+    std::string complete = (directory / "complete.tsv").string();
+    combine_categorical_runs_tests::combine_comparisons(comparisons, complete,
+                                                        true, defaults);
+    std::vector<std::string> complete_lines = read_lines(complete);
+    std::vector<std::string> consensus_p =
+        column(complete_lines, "P_CONSENSUS");
+    std::vector<double> min_p = min_p_column(complete_lines, 2);
+    combine_categorical_runs::output_filter_settings significant;
+    significant.max_consensus_p = 1e-3;
+    significant.max_min_p = 5e-4;
+    std::vector<std::string> expected(1, "");
+    for (unsigned i = 0; i < consensus_p.size(); ++i) {
+      if (combine_categorical_runs::from_string<double>(consensus_p.at(i)) <=
+              significant.max_consensus_p &&
+          min_p.at(i) <= significant.max_min_p)
+        expected.push_back(complete_lines.at(i + 1));
+    }
+    std::string thresholded = (directory / "thresholded.tsv").string();
+    combine_categorical_runs_tests::combine_comparisons(
+        comparisons, thresholded, true, significant);
+    std::vector<std::string> thresholded_lines = read_lines(thresholded);
+    tap.ok(expected.size() > 2 && expected.size() < complete_lines.size() &&
+               thresholded_lines.size() == expected.size() &&
+               std::equal(expected.begin() + 1, expected.end(),
+                          thresholded_lines.begin() + 1),
+           "process_data thresholds match filtering complete output");
+    tap.ok(!thresholded_lines.empty() &&
+               thresholded_lines.at(0).size() > 18 &&
+               !thresholded_lines.at(0).compare(
+                   thresholded_lines.at(0).size() - 18, 18,
+                   "\tFILTERED_DATASETS"),
+           "filtered output names its dataset column FILTERED_DATASETS");
+
+    std::vector<std::pair<double, unsigned> > ranked;
+    for (unsigned i = 0; i < consensus_p.size(); ++i) {
+      ranked.push_back(std::make_pair(
+          combine_categorical_runs::from_string<double>(consensus_p.at(i)), i));
+    }
+    std::sort(ranked.begin(), ranked.end());
+    std::vector<unsigned> kept;
+    for (unsigned i = 0; i < 15 && i < ranked.size(); ++i) {
+      kept.push_back(ranked.at(i).second);
+    }
+    std::sort(kept.begin(), kept.end());
+    expected.assign(1, "");
+    for (unsigned i = 0; i < kept.size(); ++i) {
+      expected.push_back(complete_lines.at(kept.at(i) + 1));
+    }
+    combine_categorical_runs::output_filter_settings best;
+    best.top_k = 15;
+    std::string selected = (directory / "selected.tsv").string();
+    combine_categorical_runs_tests::combine_comparisons(comparisons, selected,
+                                                        true, best);
+    std::vector<std::string> selected_lines = read_lines(selected);
+    tap.ok(selected_lines.size() == 16 &&
+               std::equal(expected.begin() + 1, expected.end(),
+                          selected_lines.begin() + 1),
+           "process_data top-K matches ranking complete output");
+  } catch (const std::exception &e) {
+    tap.ok(false, std::string("unexpected exception: ") + e.what());
+  }
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(directory, ec);
+  return tap.finish();
+}
@@ -0,0 +1,122 @@
+/*!
+  \file partitioned_test.cc
+  \brief agreement of the threaded consensus filter with the map filter
+  \copyright Released under the MIT License.
+  Copyright 2021 Cameron Palmer
+*/
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "combine_categorical_runs/consensus.h"
+#include "combine_categorical_runs/process.h"
+#include "tests/fixtures.h"
+#include "tests/tap.h"
+
+namespace {
+using combine_categorical_runs_tests::lcg;
+using combine_categorical_runs_tests::write_saige_file;
+
+/*!
+  \brief compare a partitioned filter against the map filter
+  @param filenames input files
+  @param ids variant ID of each data line of each input
+  @param n_threads worker threads for the partitioned filter
+  \return whether the count of complete variants and every retain() agree
+ */
+bool agrees_with_map(const std::vector<std::string> &filenames,
+                     const std::vector<std::vector<std::string> > &ids,
+                     unsigned n_threads) {
+  std::map<std::string, unsigned> counts;
+  for (unsigned i = 0; i < filenames.size(); ++i) {
+    combine_categorical_runs::find_consensus_variants(filenames.at(i),
+                                                      &counts);
+  }
+  combine_categorical_runs::map_consensus_filter reference(counts,
+                                                           filenames.size());
+  combine_categorical_runs::partitioned_consensus_filter partitioned(
+      filenames, n_threads);
+  if (!reference.complete_variant_count() ||
+      partitioned.complete_variant_count() !=
+          reference.complete_variant_count())
+    return false;
+  for (unsigned i = 0; i < ids.size(); ++i) {
+    for (unsigned j = 0; j < ids.at(i).size(); ++j) {
+      if (partitioned.retain(i, ids.at(i).at(j)) !=
+          reference.retain(i, ids.at(i).at(j)))
+        return false;
+    }
+  }
+  return !partitioned.retain(0, "absent:A:G");
+}
+
+/*!
+  \brief write several SAIGE-like files over a shared variant pool
+  @param prefix path prefix of files to write
+  @param n_files number of files
+  @param pool_size number of distinct variants to draw from
+  @param generator random source
+  @param filenames names of files written; filled
+  @param ids variant ID of each data line of each file; filled
+ */
+void write_inputs(const std::string &prefix, unsigned n_files,
+                  unsigned pool_size, lcg *generator,
+                  std::vector<std::string> *filenames,
+                  std::vector<std::vector<std::string> > *ids) {
+  for (unsigned i = 0; i < n_files; ++i) {
+    std::ostringstream name;
+    name << prefix << i << ".txt";
+    filenames->push_back(name.str());
+    ids->push_back(write_saige_file(name.str(), pool_size, generator));
+  }
+}
+}  // namespace
+
+int main() {
+  combine_categorical_runs_tests::tap_reporter tap;
+  boost::filesystem::path directory =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("partitioned_test-%%%%-%%%%-%%%%");
+  boost::filesystem::create_directories(directory);
+  try {
+    lcg generator(29);
+    std::vector<std::string> filenames;
+    std::vector<std::vector<std::string> > ids;
+    write_inputs((directory / "small").string(), 4, 400, &generator,
+                 &filenames, &ids);
+    tap.ok(agrees_with_map(filenames, ids, 1),
+           "one thread matches map_consensus_filter");
+    tap.ok(agrees_with_map(filenames, ids, 3),
+           "three threads match map_consensus_filter");
+    tap.ok(agrees_with_map(filenames, ids, 8),
+           "more threads than files match map_consensus_filter");
+
+    // enough lines per file to fill several sorted runs
+    std::vector<std::string> large_filenames;
+    std::vector<std::vector<std::string> > large_ids;
+    write_inputs((directory / "large").string(), 2, 150000, &generator,
+                 &large_filenames, &large_ids);
+    tap.ok(agrees_with_map(large_filenames, large_ids, 2),
+           "runs merged across key ranges match map_consensus_filter");
+    tap.ok(agrees_with_map(large_filenames, large_ids, 5),
+           "uneven key ranges match map_consensus_filter");
+
+    filenames.push_back((directory / "missing.txt").string());
+    tap.throws<std::runtime_error>(
+        [&]() {
+          combine_categorical_runs::partitioned_consensus_filter partitioned(
+              filenames, 2);
+        },
+        "worker errors reach the caller");
+  } catch (const std::exception &e) {
+    tap.ok(false, std::string("unexpected exception: ") + e.what());
+  }
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(directory, ec);
+  return tap.finish();
+}
@@ -0,0 +1,68 @@
+/*!
+ \file tap.h
+ \brief minimal Test Anything Protocol reporting for unit test programs
+ \copyright Released under the MIT License.
+ Copyright 2021 Cameron Palmer
+ */
+
+#ifndef TESTS_TAP_H_
+#define TESTS_TAP_H_
+
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <string>
+
+namespace combine_categorical_runs_tests {
+/*!
+  \class tap_reporter
+  \brief emit one TAP result line per check and the plan at exit
+ */
+class tap_reporter {
+ public:
+  tap_reporter() : _n_tests(0), _n_failures(0) {}
+  /*!
+    \brief report the result of a single check
+    @param passed whether the check passed
+    @param description short description of the check
+   */
+  void ok(bool passed, const std::string &description) {
+    ++_n_tests;
+    if (!passed) ++_n_failures;
+    std::cout << (passed ? "ok " : "not ok ") << _n_tests << " - "
+              << description << std::endl;
+  }
+  /*!
+    \brief report whether a function throws an exception of a given type
+    @tparam exception_type class of expected exception
+    @param func function to run
+    @param description short description of the check
+   */
+  template <class exception_type>
+  void throws(const std::function<void()> &func,
+              const std::string &description) {
+    bool caught = false;
+    try {
+      func();
+    } catch (const exception_type &) {
+      caught = true;
+    } catch (...) {
+    }
+    ok(caught, description);
+  }
+  /*!
+    \brief emit the plan
+    \return process exit status: nonzero if any check failed
+   */
+  int finish() const {
+    std::cout << "1.." << _n_tests << std::endl;
+    return _n_failures ? 1 : 0;
+  }
+
+ private:
+  unsigned _n_tests;     //!< checks reported so far
+  unsigned _n_failures;  //!< failed checks reported so far
+};
+}  // namespace combine_categorical_runs_tests
+
+#endif  // TESTS_TAP_H_